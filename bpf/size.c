@@ -1,9 +1,44 @@
 #include <stdio.h>
 #include "uring.h"
 
+#define PRINT_SIZE(payload)                                                    \
+  printf("%-28s %zu\n", #payload,                                              \
+         sizeof(struct event) + sizeof(struct payload))
+
 int main() {
 
-  printf("Sizeof(event) %zu\n", sizeof(struct event));
+  printf("Sizeof(event) header %zu\n", sizeof(struct event));
+  PRINT_SIZE(io_uring_create);
+  PRINT_SIZE(ring_snapshot);
+  PRINT_SIZE(io_uring_register);
+  PRINT_SIZE(io_uring_file_get);
+  PRINT_SIZE(io_uring_submit_sqe);
+  PRINT_SIZE(io_uring_queue_async_work);
+  PRINT_SIZE(io_uring_poll_arm);
+  PRINT_SIZE(io_uring_task_add);
+  PRINT_SIZE(io_uring_task_work_run);
+  PRINT_SIZE(io_uring_short_write);
+  PRINT_SIZE(io_uring_local_work_run);
+  PRINT_SIZE(io_uring_defer);
+  PRINT_SIZE(io_uring_link);
+  PRINT_SIZE(io_uring_fail_link);
+  PRINT_SIZE(io_uring_cqring_wait);
+  PRINT_SIZE(io_uring_req_failed);
+  PRINT_SIZE(io_uring_cqe_overflow);
+  PRINT_SIZE(io_uring_complete);
+  PRINT_SIZE(io_init_new_worker);
+  PRINT_SIZE(io_wq_work_begin);
+  PRINT_SIZE(io_wq_work_end);
+  PRINT_SIZE(sched_switch);
+  PRINT_SIZE(sched_wakeup);
+  PRINT_SIZE(block_rq);
+  PRINT_SIZE(task_comm);
+  PRINT_SIZE(lost_events);
+  PRINT_SIZE(sys_enter_io_uring_enter);
+  PRINT_SIZE(sys_exit_io_uring_enter);
+  PRINT_SIZE(slow_step);
+  PRINT_SIZE(ring_occupancy);
+  PRINT_SIZE(page_cache_stats);
 
   return 0;
 
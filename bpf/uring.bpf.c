@@ -1,5 +1,6 @@
 #include "vmlinux.h"
 #include "uring.h"
+#include <bpf/bpf_core_read.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 
@@ -7,104 +8,1028 @@ extern u32 LINUX_KERNEL_VERSION __kconfig;
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-/* BPF ringbuf map */
+/* BPF ringbuf map, userspace may resize it before loading */
 struct {
   __uint(type, BPF_MAP_TYPE_RINGBUF);
-  __uint(max_entries, 256 * 4096 /* 256 KB */);
+  __uint(max_entries, 256 * 4096 /* 1 MB */);
 } rb SEC(".maps");
 
-/* Globals implemented as an array */
-/* pid | total | lost | skipped | unrelated | sampling_idx | user_idx */
+/* Sharded mode: CPUs are split into groups that each write to their
+   own ring buffer instead of contending on rb */
+
+struct rb_shard {
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, 256 * 4096 /* 1 MB */);
+};
+
+struct rb_shard rb_0 SEC(".maps");
+struct rb_shard rb_1 SEC(".maps");
+struct rb_shard rb_2 SEC(".maps");
+struct rb_shard rb_3 SEC(".maps");
+struct rb_shard rb_4 SEC(".maps");
+struct rb_shard rb_5 SEC(".maps");
+struct rb_shard rb_6 SEC(".maps");
+struct rb_shard rb_7 SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+  __uint(max_entries, MAX_SHARDS);
+  __type(key, u32);
+  __array(values, struct rb_shard);
+} rb_shards SEC(".maps") = {
+    .values = {&rb_0, &rb_1, &rb_2, &rb_3, &rb_4, &rb_5, &rb_6, &rb_7},
+};
+
+/* Globals implemented as an array, written by userspace before the
+   probes are attached */
+/* pid | sample_num | cgroup | comm_idx | sample_den | adaptive_idx |
+   hist_idx | wakeup_idx | shards_idx | stacks_idx | slow_idx |
+   occupancy_idx | page_cache_idx | block_idx | sched_idx */
 struct {
   __uint(type, BPF_MAP_TYPE_ARRAY);
-  __uint(max_entries, 7);
+  __uint(max_entries, 15);
   __type(key, int);
   __type(value, long);
 } globals SEC(".maps");
 
 const int pid_idx = 0;
-const int total_idx = 1;
-const int lost_idx = 2;
-const int skipped_idx = 3;
-const int unrelated_idx = 4;
-const int sampling_idx = 5;
-const int user_idx = 6;
+const int sample_num_idx = 1;
+const int cgroup_idx = 2;
+const int comm_idx = 3;
+const int sample_den_idx = 4;
+const int adaptive_idx = 5;
+const int hist_idx = 6;
+const int wakeup_idx = 7;
+const int shards_idx = 8;
+const int stacks_idx = 9;
+const int slow_idx = 10;
+const int occupancy_idx = 11;
+/* Set while the page_cache, block and sched categories are on */
+const int page_cache_idx = 12;
+const int block_idx = 13;
+const int sched_idx = 14;
+
+/* Command name to trace, only read when comm_idx is set */
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, int);
+  __type(value, struct task_comm);
+} comm_filter SEC(".maps");
+
+/* Counters implemented as a per-CPU array so that probes firing on
+   different CPUs never share a cache line. Userspace adds up the
+   per-CPU slots when reading them */
+/* total | lost | skipped | unrelated | user_idx | peak_idx |
+   stack_fail_idx */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 7);
+  __type(key, int);
+  __type(value, long);
+} counters SEC(".maps");
+
+const int total_idx = 0;
+const int lost_idx = 1;
+const int skipped_idx = 2;
+const int unrelated_idx = 3;
+const int user_idx = 4;
+const int peak_idx = 5;
+const int stack_fail_idx = 6;
 
 static void __incr(const int *idx) {
   long *value;
-  value = bpf_map_lookup_elem(&globals, idx);
+  value = bpf_map_lookup_elem(&counters, idx);
   if (value == NULL) {
     bpf_printk("Error got NULL");
     return;
   };
+  /* The slot belongs to this CPU, no update call needed */
   (*value)++;
-  bpf_map_update_elem(&globals, idx, value, 0);
 }
 
-static int __filter_event(void *req) {
+static void __max(const int *idx, long v) {
+  long *value;
+  value = bpf_map_lookup_elem(&counters, idx);
+  if (value == NULL) {
+    bpf_printk("Error got NULL");
+    return;
+  };
+  if (v > *value)
+    *value = v;
+}
 
-  /* Skip if perfect modulus of sampling_value */
+static long __global(const int *idx) {
   long *value;
-  value = bpf_map_lookup_elem(&globals, &sampling_idx);
+  value = bpf_map_lookup_elem(&globals, idx);
   if (value == NULL) {
     bpf_printk("Error got NULL");
     return 0;
   };
+  return *value;
+}
+
+/* Ring buffer that this CPU writes to */
+static __always_inline void *__ring(void) {
+  long shards = __global(&shards_idx);
+  void *shard;
+  u32 key;
+
+  if (shards > 1) {
+    key = bpf_get_smp_processor_id() % shards;
+    shard = bpf_map_lookup_elem(&rb_shards, &key);
+    if (shard != NULL)
+      return shard;
+  }
+  return &rb;
+}
+
+static int __comm_differs(const char *comm) {
+  struct task_comm *target;
+  int zero = 0;
+
+  target = bpf_map_lookup_elem(&comm_filter, &zero);
+  if (target == NULL)
+    return 0;
 
-  if (*value == 1) {
-    uint32_t hash = (uint32_t)req * (2654435761);
-    if (hash % 10 != 0) {
-      __incr(&skipped_idx);
+  for (int i = 0; i < TASK_COMM_LEN; i++) {
+    if (comm[i] != target->comm[i])
       return 1;
-    };
+    if (comm[i] == '\0')
+      break;
+  };
+  return 0;
+}
+
+/* Skip tasks outside of the targeted pid, cgroup or command name.
+   Only needed on probes that don't carry a ring ctx, since rings are
+   only registered when their creator passes this filter */
+static int __filter_task(void) {
+  char comm[TASK_COMM_LEN];
+  long pid, cgroup;
+
+  pid = __global(&pid_idx);
+  if (pid != 0 && (bpf_get_current_pid_tgid() >> 32) != pid)
+    goto skip;
+
+  cgroup = __global(&cgroup_idx);
+  if (cgroup != 0 && bpf_get_current_cgroup_id() != cgroup)
+    goto skip;
+
+  if (__global(&comm_idx) != 0) {
+    bpf_get_current_comm(&comm, sizeof(comm));
+    if (__comm_differs(comm))
+      goto skip;
+  }
+
+  return 0;
+
+skip:
+  __incr(&unrelated_idx);
+  return 1;
+}
+
+/* Rings that we have seen being created, ctx -> tgid of the owner.
+   Only events on these rings are sent to userspace, everything else
+   is counted as unrelated */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 1024);
+  __type(key, u64);
+  __type(value, u32);
+} rings SEC(".maps");
+
+/* Ring of each ring fd, so that io_uring_enter calls can be matched to
+   their ring */
+struct ring_fd {
+  u32 tgid;
+  int fd;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 1024);
+  __type(key, struct ring_fd);
+  __type(value, u64);
+} ring_fds SEC(".maps");
+
+static void __register_ring(void *ring_ctx, u32 tgid, int fd) {
+  struct ring_fd fd_key = {.tgid = tgid, .fd = fd};
+  u64 key = (u64)ring_ctx;
+  bpf_map_update_elem(&rings, &key, &tgid, BPF_ANY);
+  bpf_map_update_elem(&ring_fds, &fd_key, &key, BPF_ANY);
+}
+
+static int __filter_ring(void *ring_ctx) {
+  u64 key = (u64)ring_ctx;
+  if (bpf_map_lookup_elem(&rings, &key) == NULL) {
+    __incr(&unrelated_idx);
+    return 1;
+  };
+  return 0;
+}
+
+/* Threads that we have seen creating rings, submitting requests or
+   running io-wq work, tid -> tgid. The scheduler probes only report
+   on these, nothing is tracked while they are off */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, u32);
+  __type(value, u32);
+} tasks SEC(".maps");
+
+static void __track_tid(u32 tid, u32 tgid) {
+  if (__global(&sched_idx) != 0)
+    bpf_map_update_elem(&tasks, &tid, &tgid, BPF_ANY);
+}
+
+static void __track_task(void) {
+  u64 id = bpf_get_current_pid_tgid();
+  __track_tid(id, id >> 32);
+}
+
+/* tgid of a tracked thread, 0 if it isn't tracked */
+static u32 __tracked_tgid(u32 tid) {
+  u32 *tgid = bpf_map_lookup_elem(&tasks, &tid);
+  return tgid == NULL ? 0 : *tgid;
+}
+
+/* Block layer correlation: the request a thread is issuing, set on
+   submission and when an io-wq worker picks up work, cleared once the
+   issue is over. Bios queued by that thread are attributed to the
+   request, and block requests to the request of their first bio */
+struct req_ref {
+  void *ctx;
+  void *req;
+  u32 pid;
+  u8 opcode;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, u32);
+  __type(value, struct req_ref);
+} issuing SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct req_ref);
+} bios SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct req_ref);
+} block_rqs SEC(".maps");
+
+/* Only the block and page_cache categories read issuing */
+static bool __issuing_needed(void) {
+  return __global(&block_idx) != 0 || __global(&page_cache_idx) != 0;
+}
+
+static void __set_issuing(void *ctx, void *req, u8 opcode) {
+  u64 id = bpf_get_current_pid_tgid();
+  u32 tid = id;
+  struct req_ref ref = {
+      .ctx = ctx, .req = req, .pid = id >> 32, .opcode = opcode};
+  if (__issuing_needed())
+    bpf_map_update_elem(&issuing, &tid, &ref, BPF_ANY);
+}
+
+static void __clear_issuing(void) {
+  u32 tid = bpf_get_current_pid_tgid();
+  if (__issuing_needed())
+    bpf_map_delete_elem(&issuing, &tid);
+}
+
+#define IORING_CQE_F_MORE (1U << 1)
+
+/* Requests picked by the adaptive sampler, so that every event of a
+   request follows the decision taken at submission even when the
+   rate changes in between */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, u8);
+} sampled SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, int);
+  __type(value, struct sample_state);
+} sample_states SEC(".maps");
+
+/* Re-evaluate the adaptive rate at most this often on each CPU */
+#define ADAPT_PERIOD_NS 10000000
+#define MAX_SAMPLE_SHIFT 16
+
+/* Halve the sampling rate when the ring buffer is more than half full
+   or events were lost since the last check, double it back up when
+   the ring buffer is mostly empty */
+static u32 __adapt_shift(void) {
+  struct sample_state *st;
+  long *lost;
+  u64 now, avail, size;
+  int zero = 0;
+
+  st = bpf_map_lookup_elem(&sample_states, &zero);
+  if (st == NULL)
+    return 0;
+
+  now = bpf_ktime_get_ns();
+  if (now - st->last_ts < ADAPT_PERIOD_NS)
+    return st->shift;
+  st->last_ts = now;
+
+  lost = bpf_map_lookup_elem(&counters, &lost_idx);
+  avail = bpf_ringbuf_query(__ring(), BPF_RB_AVAIL_DATA);
+  size = bpf_ringbuf_query(__ring(), BPF_RB_RING_SIZE);
+  if ((lost != NULL && *lost != st->last_lost) || avail * 2 > size) {
+    if (st->shift < MAX_SAMPLE_SHIFT)
+      st->shift++;
+  } else if (avail * 8 < size && st->shift > 0) {
+    st->shift--;
   };
+  if (lost != NULL)
+    st->last_lost = *lost;
+
+  return st->shift;
+}
+
+/* Keep hash(req) % (den << shift) < num out of every request */
+static int __sample_out(void *req, long den, u32 shift) {
+  u32 hash = (u32)(u64)req * (2654435761);
+  u64 scaled = (u64)den << shift;
+  return scaled == 0 || hash % scaled >= __global(&sample_num_idx);
+}
+
+/* Sampling decision taken when a request is submitted */
+static int __filter_submit(void *req) {
+  long den = __global(&sample_den_idx);
+  u32 shift = 0;
+  u64 key = (u64)req;
+  u8 one = 1;
+
+  if (den == 0)
+    return 0;
+
+  if (__global(&adaptive_idx) != 0)
+    shift = __adapt_shift();
 
+  if (__sample_out(req, den, shift)) {
+    __incr(&skipped_idx);
+    return 1;
+  };
+
+  if (__global(&adaptive_idx) != 0)
+    bpf_map_update_elem(&sampled, &key, &one, BPF_ANY);
+  return 0;
+}
+
+/* Follow the decision taken at submission for the later events */
+static int __filter_event(void *req) {
+  long den = __global(&sample_den_idx);
+  u64 key = (u64)req;
+
+  if (den == 0)
+    return 0;
+
+  if (__global(&adaptive_idx) != 0) {
+    if (bpf_map_lookup_elem(&sampled, &key) == NULL)
+      goto skip;
+    return 0;
+  };
+
+  if (__sample_out(req, den, 0))
+    goto skip;
   return 0;
+
+skip:
+  __incr(&skipped_idx);
+  return 1;
+}
+
+/* The request is done once it posts its last CQE */
+static void __forget_sampled(void *req, unsigned int cflags) {
+  u64 key = (u64)req;
+  if (!(cflags & IORING_CQE_F_MORE) && __global(&adaptive_idx) != 0)
+    bpf_map_delete_elem(&sampled, &key);
+}
+
+/* Work punted to io-wq, keyed by its io_wq_work pointer. Entries are
+   added by io_uring_queue_async_work and removed once a worker is done
+   with the work, so only work on traced rings gets a span */
+struct queued_work {
+  u64 ts;
+  void *ctx;
+  void *req;
+  u8 opcode;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct queued_work);
+} queued_works SEC(".maps");
+
+/* Histogram mode: requests are timed in the kernel and only the
+   aggregated latencies are read by userspace */
+struct inflight {
+  u64 ts;
+  u32 opcode;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct inflight);
+} inflight SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, struct hist_key);
+  __type(value, struct hist);
+} hists SEC(".maps");
+
+static u32 __log2(u64 v) {
+  u32 r = 0;
+  for (int i = 32; i > 0; i >>= 1) {
+    if (v >= (1ULL << i)) {
+      v >>= i;
+      r += i;
+    };
+  };
+  return r;
 }
 
-static struct event *__init_event(enum tracepoint_t ty) {
+static void __hist_submit(void *req, u8 opcode) {
+  struct inflight val = {.ts = bpf_ktime_get_ns(), .opcode = opcode};
+  u64 key = (u64)req;
+  bpf_map_update_elem(&inflight, &key, &val, BPF_ANY);
+}
+
+static const struct hist zero_hist = {};
+
+static void __hist_complete(void *ring_ctx, void *req, unsigned int cflags) {
+  struct hist_key hkey = {};
+  struct inflight *val;
+  struct hist *hist;
+  u64 key = (u64)req;
+  u32 slot;
+
+  val = bpf_map_lookup_elem(&inflight, &key);
+  if (val == NULL)
+    return;
+
+  slot = __log2(bpf_ktime_get_ns() - val->ts);
+  if (slot >= HIST_SLOTS)
+    slot = HIST_SLOTS - 1;
+
+  hkey.ctx = (u64)ring_ctx;
+  hkey.opcode = val->opcode;
+  /* Multishot requests keep timing every CQE from their submission */
+  if (!(cflags & IORING_CQE_F_MORE))
+    bpf_map_delete_elem(&inflight, &key);
+
+  hist = bpf_map_lookup_elem(&hists, &hkey);
+  if (hist == NULL) {
+    bpf_map_update_elem(&hists, &hkey, &zero_hist, BPF_NOEXIST);
+    hist = bpf_map_lookup_elem(&hists, &hkey);
+    if (hist == NULL)
+      return;
+  };
+  /* Per-CPU value, no atomics needed */
+  hist->slots[slot]++;
+}
+
+/* Payload of a record sits right after its header */
+#define event_data(e) ((void *)((e) + 1))
+
+/* Losses per tracepoint type, per CPU */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, MAX_TRACEPOINTS);
+  __type(key, u32);
+  __type(value, long);
+} lost_by_type SEC(".maps");
+
+/* Losses on this CPU that haven't been reported in the ring yet */
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, int);
+  __type(value, struct lost_events);
+} pending_losses SEC(".maps");
+
+static void __count_lost_type(enum tracepoint_t ty) {
+  u32 key = ty;
+  long *value;
+
+  __incr(&lost_idx);
+  value = bpf_map_lookup_elem(&lost_by_type, &key);
+  if (value != NULL)
+    (*value)++;
+}
+
+static void __count_loss(enum tracepoint_t ty) {
+  struct lost_events *pending;
+  int zero = 0;
+
+  __count_lost_type(ty);
+  pending = bpf_map_lookup_elem(&pending_losses, &zero);
+  if (pending == NULL)
+    return;
+  if (pending->count == 0)
+    pending->since = bpf_ktime_get_ns();
+  pending->count++;
+}
+
+/* The first record that makes it after losses is preceded by a
+   LOST_EVENTS marker, in the same ring since CPUs always map to the
+   same shard */
+static void __send_losses(u64 id) {
+  struct lost_events *pending, *extra;
   struct event *e;
-  u64 id;
+  int zero = 0;
+
+  pending = bpf_map_lookup_elem(&pending_losses, &zero);
+  if (pending == NULL || pending->count == 0)
+    return;
+
+  /* The losses stay pending for the next record */
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(*extra), 0);
+  if (!e) {
+    __count_lost_type(LOST_EVENTS);
+    return;
+  }
+  e->ty = LOST_EVENTS;
+  e->pid = id >> 32;
+  e->tid = id;
+  e->ts = bpf_ktime_get_ns();
+  extra = event_data(e);
+  extra->count = pending->count;
+  extra->since = pending->since;
+  bpf_ringbuf_submit(e, BPF_RB_NO_WAKEUP);
+
+  pending->count = 0;
+}
+
+/* Threads whose comm userspace already knows. Renames after the first
+   event (e.g. PR_SET_NAME) aren't picked up */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, u32);
+  __type(value, u8);
+} comm_sent SEC(".maps");
+
+/* Sends a TASK_COMM record the first time a thread has an event. It
+   lands in the same ring right before that event, which does the
+   wakeup */
+static void __send_comm(u64 id) {
+  struct event *e;
+  struct task_comm *extra;
+  u32 tid = id;
+  u8 one = 1;
+
+  if (bpf_map_lookup_elem(&comm_sent, &tid) != NULL)
+    return;
+
+  /* Tried again on the thread's next event */
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(*extra), 0);
+  if (!e) {
+    __count_loss(TASK_COMM);
+    return;
+  }
+  e->ty = TASK_COMM;
+  e->pid = id >> 32;
+  e->tid = id;
+  e->ts = bpf_ktime_get_ns();
+  extra = event_data(e);
+  bpf_get_current_comm(&extra->comm, sizeof(extra->comm));
+  bpf_ringbuf_submit(e, BPF_RB_NO_WAKEUP);
+
+  bpf_map_update_elem(&comm_sent, &tid, &one, BPF_ANY);
+}
+
+static struct event *__init_event(enum tracepoint_t ty, unsigned long size) {
+  struct event *e;
+  u64 id = bpf_get_current_pid_tgid();
 
   __incr(&user_idx);
+  __send_comm(id);
+  __send_losses(id);
   /* Try to reserve space from BPF ringbuf */
-  e = bpf_ringbuf_reserve(&rb, sizeof(*e), 0);
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + size, 0);
   if (!e) {
-    __incr(&lost_idx);
+    __count_loss(ty);
     return NULL;
   }
-  id = bpf_get_current_pid_tgid();
   e->ty = ty;
   e->pid = id >> 32;
   e->tid = id;
   e->ts = bpf_ktime_get_ns();
-  bpf_get_current_comm(&e->comm, sizeof(e->comm));
 
   return e;
 }
 
+/* With a wakeup watermark set, the consumer is only woken up once
+   that many bytes are waiting. Userspace drains whatever is left when
+   its poll times out */
+static __always_inline void __submit_event(struct event *e) {
+  long watermark = __global(&wakeup_idx);
+  long avail = bpf_ringbuf_query(__ring(), BPF_RB_AVAIL_DATA);
+  u64 flags = 0;
+
+  /* Track the fill level to help sizing the ring buffer */
+  __max(&peak_idx, avail);
+  if (watermark != 0)
+    flags = avail >= watermark ? BPF_RB_FORCE_WAKEUP : BPF_RB_NO_WAKEUP;
+  bpf_ringbuf_submit(e, flags);
+}
+
+/* Slow mode: requests are held back in the kernel until they complete
+   and only sent to userspace when they took at least slow_idx ns. The
+   submit record is kept whole, intermediate events only as the type,
+   thread and time of the step */
+#define SLOW_STEPS 8
+
+struct slow_step_ref {
+  u32 ty;
+  u32 tid;
+  u64 ts;
+};
+
+struct slow_req {
+  struct event hdr;
+  struct io_uring_submit_sqe submit;
+  u32 nsteps;
+  struct slow_step_ref steps[SLOW_STEPS];
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct slow_req);
+} slow_reqs SEC(".maps");
+
+static const struct slow_req zero_slow_req = {};
+
+/* Submit record to fill in, NULL if the request can't be held */
+static struct io_uring_submit_sqe *__slow_submit(void *req) {
+  u64 id = bpf_get_current_pid_tgid();
+  struct slow_req *r;
+  u64 key = (u64)req;
+
+  /* Sent now, the thread may never show up again */
+  __send_comm(id);
+  bpf_map_update_elem(&slow_reqs, &key, &zero_slow_req, BPF_ANY);
+  r = bpf_map_lookup_elem(&slow_reqs, &key);
+  if (r == NULL)
+    return NULL;
+  r->hdr.ty = IO_URING_SUBMIT_SQE;
+  r->hdr.pid = id >> 32;
+  r->hdr.tid = id;
+  r->hdr.ts = bpf_ktime_get_ns();
+  return &r->submit;
+}
+
+/* In slow mode, keeps the event as a step of its request instead of
+   sending it. Steps past SLOW_STEPS are dropped */
+static int __slow_step(enum tracepoint_t ty, void *req) {
+  struct slow_req *r;
+  u64 key = (u64)req;
+  u32 i;
+
+  if (__global(&slow_idx) == 0)
+    return 0;
+
+  r = bpf_map_lookup_elem(&slow_reqs, &key);
+  if (r == NULL)
+    return 1;
+  i = r->nsteps;
+  if (i >= SLOW_STEPS)
+    return 1;
+  r->steps[i].ty = ty;
+  r->steps[i].tid = bpf_get_current_pid_tgid();
+  r->steps[i].ts = bpf_ktime_get_ns();
+  r->nsteps = i + 1;
+  return 1;
+}
+
+static void __slow_flush(struct slow_req *r) {
+  struct slow_step *extra;
+  struct event *e;
+
+  __incr(&user_idx);
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(r->submit), 0);
+  if (!e) {
+    __count_loss(IO_URING_SUBMIT_SQE);
+    return;
+  }
+  __builtin_memcpy(e, &r->hdr, sizeof(*e));
+  __builtin_memcpy(event_data(e), &r->submit, sizeof(r->submit));
+  __submit_event(e);
+
+  for (u32 i = 0; i < SLOW_STEPS; i++) {
+    if (i >= r->nsteps)
+      break;
+    __incr(&user_idx);
+    e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(*extra), 0);
+    if (!e) {
+      __count_loss(SLOW_STEP);
+      continue;
+    }
+    e->ty = SLOW_STEP;
+    e->pid = r->hdr.pid;
+    e->tid = r->steps[i].tid;
+    e->ts = r->steps[i].ts;
+    extra = event_data(e);
+    extra->ctx = r->submit.ctx;
+    extra->req = r->submit.req;
+    extra->step = r->steps[i].ty;
+    __submit_event(e);
+  }
+}
+
+/* Whether the completion should be sent: only for the last CQE of a
+   slow request, once its held back events are out. Earlier CQEs of
+   multishot requests are steps */
+static int __slow_complete(void *req, unsigned int cflags) {
+  struct slow_req *r;
+  u64 key = (u64)req;
+  u64 latency;
+
+  if (cflags & IORING_CQE_F_MORE) {
+    __slow_step(IO_URING_COMPLETE, req);
+    return 0;
+  }
+
+  r = bpf_map_lookup_elem(&slow_reqs, &key);
+  if (r == NULL)
+    return 0;
+  latency = bpf_ktime_get_ns() - r->hdr.ts;
+  if (latency < __global(&slow_idx)) {
+    __incr(&skipped_idx);
+    bpf_map_delete_elem(&slow_reqs, &key);
+    return 0;
+  }
+  __slow_flush(r);
+  bpf_map_delete_elem(&slow_reqs, &key);
+  return 1;
+}
+
+/* Occupancy sampling: the SQ and CQ head/tail indices of a ring, read
+   from the ring memory shared with userspace. Sampled when
+   io_uring_enter returns and every occupancy_idx ms by userspace
+   running sample_occupancy */
+static void __send_occupancy(struct io_ring_ctx *ring, u32 pid, u32 tid) {
+  struct ring_occupancy *extra;
+  struct io_rings *shared;
+  struct event *e;
+
+  __incr(&user_idx);
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(*extra), 0);
+  if (!e) {
+    __count_loss(RING_OCCUPANCY);
+    return;
+  }
+  e->ty = RING_OCCUPANCY;
+  e->pid = pid;
+  e->tid = tid;
+  e->ts = bpf_ktime_get_ns();
+
+  extra = event_data(e);
+  shared = BPF_CORE_READ(ring, rings);
+  extra->ctx = ring;
+  extra->sq_head = BPF_CORE_READ(shared, sq.head);
+  extra->sq_tail = BPF_CORE_READ(shared, sq.tail);
+  extra->cq_head = BPF_CORE_READ(shared, cq.head);
+  extra->cq_tail = BPF_CORE_READ(shared, cq.tail);
+  extra->sq_entries = BPF_CORE_READ(ring, sq_entries);
+  extra->cq_entries = BPF_CORE_READ(ring, cq_entries);
+
+  __submit_event(e);
+}
+
+/* Ring each thread is in io_uring_enter on */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 4096);
+  __type(key, u32);
+  __type(value, u64);
+} entering SEC(".maps");
+
+#define IORING_ENTER_REGISTERED_RING (1U << 4)
+
+static void __enter_ring(int fd, unsigned int flags) {
+  u64 id = bpf_get_current_pid_tgid();
+  struct ring_fd key = {.tgid = id >> 32, .fd = fd};
+  u32 tid = id;
+  u64 *ring;
+
+  /* Registered ring fds are indices into a private table */
+  if (__global(&occupancy_idx) == 0 || flags & IORING_ENTER_REGISTERED_RING)
+    return;
+  ring = bpf_map_lookup_elem(&ring_fds, &key);
+  if (ring != NULL)
+    bpf_map_update_elem(&entering, &tid, ring, BPF_ANY);
+}
+
+static void __exit_ring(void) {
+  u64 id = bpf_get_current_pid_tgid();
+  u32 tid = id;
+  u64 *ring;
+
+  ring = bpf_map_lookup_elem(&entering, &tid);
+  if (ring == NULL)
+    return;
+  __send_occupancy((struct io_ring_ctx *)*ring, id >> 32, tid);
+  bpf_map_delete_elem(&entering, &tid);
+}
+
+/* Walks the rings map, userspace runs it on a timer */
+SEC("iter/bpf_map_elem")
+int sample_occupancy(struct bpf_iter__bpf_map_elem *ctx) {
+  u64 *ring = ctx->key;
+  u32 *tgid = ctx->value;
+
+  if (ring == NULL || tgid == NULL)
+    return 0;
+  __send_occupancy((struct io_ring_ctx *)*ring, *tgid, *tgid);
+  return 0;
+}
+
+/* Page cache activity of each request, see __count_page_cache */
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 65536);
+  __type(key, u64);
+  __type(value, struct page_cache_stats);
+} page_cache SEC(".maps");
+
+static const struct page_cache_stats zero_page_cache = {};
+
+/* Buffered writes add pages to the page cache too, only reads tell
+   hits from misses */
+static bool __is_read(u8 opcode) {
+  return opcode == IORING_OP_READ || opcode == IORING_OP_READV ||
+         opcode == IORING_OP_READ_FIXED;
+}
+
+/* Stats are created when a read is issued, the page cache probes only
+   count into existing ones */
+static void __watch_page_cache(void *req, u8 opcode) {
+  u64 key = (u64)req;
+
+  if (__global(&page_cache_idx) != 0 && __is_read(opcode))
+    bpf_map_update_elem(&page_cache, &key, &zero_page_cache, BPF_NOEXIST);
+}
+
+/* Sent right before the completion of a request that went through the
+   page cache */
+static void __send_page_cache(void *ring_ctx, void *req, unsigned int cflags) {
+  struct page_cache_stats *stats, *extra;
+  struct event *e;
+  u64 key = (u64)req;
+
+  if (__global(&page_cache_idx) == 0)
+    return;
+  stats = bpf_map_lookup_elem(&page_cache, &key);
+  if (stats == NULL)
+    return;
+
+  /* Reads that didn't go through the page cache, e.g. O_DIRECT */
+  if (stats->accessed == 0 && stats->added == 0)
+    e = NULL;
+  else
+    e = __init_event(PAGE_CACHE, sizeof(*extra));
+  if (e != NULL) {
+    extra = event_data(e);
+    extra->ctx = ring_ctx;
+    extra->req = req;
+    extra->accessed = stats->accessed;
+    extra->added = stats->added;
+    __submit_event(e);
+  }
+  /* Multishot requests report per CQE */
+  if (cflags & IORING_CQE_F_MORE)
+    *stats = zero_page_cache;
+  else
+    bpf_map_delete_elem(&page_cache, &key);
+}
+
 SEC("tp/io_uring/io_uring_create")
 int handle_create(struct trace_event_raw_io_uring_create *ctx) {
   struct event *e;
   struct io_uring_create *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_CREATE);
+  if (__filter_task() != 0)
+    return 0;
+
+  /* Register the ring even if its record gets lost */
+  __register_ring(ctx->ctx, bpf_get_current_pid_tgid() >> 32, ctx->fd);
+  __track_task();
+  e = __init_event(IO_URING_CREATE, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_create);
+  extra = event_data(e);
   extra->fd = ctx->fd;
   extra->ctx = ctx->ctx;
   extra->sq_entries = ctx->sq_entries;
   extra->cq_entries = ctx->cq_entries;
   extra->flags = ctx->flags;
 
-  /* This will overwrite if another create is encountered!! TODO */
-  /* pid = e->pid; */
-  /* bpf_map_update_elem(&globals, &pid_idx, &pid, 0); */
+  __submit_event(e);
+  return 0;
+}
 
-  bpf_ringbuf_submit(e, 0);
+/* The last reference to a ring's file is gone, the context gets freed
+   right after. Forget it so that sample_occupancy doesn't read it
+   anymore. Its ring_fds entries are left to age out of the LRU, the
+   fd isn't known here and a reused fd gets registered again */
+SEC("fentry/io_uring_release")
+int BPF_PROG(handle_ring_release, struct inode *inode, struct file *file) {
+  u64 key = (u64)file->private_data;
+
+  bpf_map_delete_elem(&rings, &key);
+  return 0;
+}
+
+/* Rings set up before tracing started never go through
+   io_uring_create. Userspace runs this iterator once after attaching,
+   it walks the open files of every process and registers the
+   io_uring ones. Weak so that the object still loads when kallsyms
+   doesn't list data symbols, nothing gets snapshotted then */
+extern const void io_uring_fops __ksym __weak;
+
+SEC("iter/task_file")
+int snapshot_rings(struct bpf_iter__task_file *ctx) {
+  struct task_struct *task = ctx->task;
+  struct file *file = ctx->file;
+  struct ring_snapshot *extra;
+  struct io_ring_ctx *ring;
+  char comm[TASK_COMM_LEN];
+  struct event *e;
+  long pid, cgroup;
+  u64 key;
+
+  if (task == NULL || file == NULL || &io_uring_fops == NULL ||
+      file->f_op != &io_uring_fops)
+    return 0;
+
+  /* Same targeting as __filter_task, on the owner of the file */
+  pid = __global(&pid_idx);
+  if (pid != 0 && task->tgid != pid)
+    return 0;
+  cgroup = __global(&cgroup_idx);
+  if (cgroup != 0 && BPF_CORE_READ(task, cgroups, dfl_cgrp, kn, id) != cgroup)
+    return 0;
+  bpf_probe_read_kernel_str(&comm, sizeof(comm), task->comm);
+  if (__global(&comm_idx) != 0 && __comm_differs(comm))
+    return 0;
+
+  /* Shared by several processes, or created after attaching */
+  ring = file->private_data;
+  key = (u64)ring;
+  if (bpf_map_lookup_elem(&rings, &key) != NULL)
+    return 0;
+
+  __register_ring(ring, task->tgid, ctx->fd);
+  __track_tid(task->pid, task->tgid);
+  __incr(&user_idx);
+  e = bpf_ringbuf_reserve(__ring(), sizeof(*e) + sizeof(*extra), 0);
+  if (!e) {
+    __count_loss(RING_SNAPSHOT);
+    return 0;
+  }
+  e->ty = RING_SNAPSHOT;
+  e->pid = task->tgid;
+  e->tid = task->pid;
+  e->ts = bpf_ktime_get_ns();
+
+  extra = event_data(e);
+  extra->fd = ctx->fd;
+  extra->ctx = ring;
+  extra->sq_entries = BPF_CORE_READ(ring, sq_entries);
+  extra->cq_entries = BPF_CORE_READ(ring, cq_entries);
+  extra->flags = BPF_CORE_READ(ring, flags);
+  __builtin_memcpy(extra->comm, comm, sizeof(comm));
+
+  __submit_event(e);
   return 0;
 }
 
@@ -114,17 +1039,20 @@ int handle_register(struct trace_event_raw_io_uring_register *ctx) {
   struct io_uring_register *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_REGISTER);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
+
+  e = __init_event(IO_URING_REGISTER, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_register);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->opcode = ctx->opcode;
   extra->nr_files = ctx->nr_files;
   extra->ret = ctx->ret;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -134,23 +1062,33 @@ int handle_file_get(struct trace_event_raw_io_uring_file_get *ctx) {
   struct io_uring_file_get *extra;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_FILE_GET, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_FILE_GET);
+  e = __init_event(IO_URING_FILE_GET, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_file_get);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->fd = ctx->fd;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
-struct trace_event_raw_io_uring_submit_req {
+/* io_uring_submit_sqe was renamed to io_uring_submit_req in 6.3 and
+   lost its force_nonblock field. Both layouts are described here with
+   CO-RE flavours, so that one object loads on either kernel: each
+   handler checks that its layout exists in the kernel BTF, and
+   userspace only attaches the one whose tracepoint exists */
+struct trace_event_raw_io_uring_submit_req___new {
   struct trace_entry ent;
   void *ctx;
   void *req;
@@ -162,68 +1100,150 @@ struct trace_event_raw_io_uring_submit_req {
   char __data[0];
 } __attribute__((preserve_access_index));
 
-/* This is a hacky way to load the right tracepoints */
-#if (MAJOR_VERSION >= 6 && MINOR_VERSION >= 3)
-SEC("tp/io_uring/io_uring_submit_req")
-int handle_submit_req(struct trace_event_raw_io_uring_submit_req *ctx) {
-#else
-SEC("tp/io_uring/io_uring_submit_sqe")
-int handle_submit_req(struct trace_event_raw_io_uring_submit_sqe *ctx) {
-#endif
+struct trace_event_raw_io_uring_submit_sqe___old {
+  struct trace_entry ent;
+  void *ctx;
+  void *req;
+  long long unsigned int user_data;
+  u8 opcode;
+  u32 flags;
+  bool force_nonblock;
+  bool sq_thread;
+  u32 __data_loc_op_str;
+  char __data[0];
+} __attribute__((preserve_access_index));
+
+/* User stacks of sampled submissions, records only carry the id */
+struct {
+  __uint(type, BPF_MAP_TYPE_STACK_TRACE);
+  __uint(max_entries, 16384);
+  __type(key, u32);
+  __uint(value_size, MAX_STACK_DEPTH * sizeof(u64));
+} stacks SEC(".maps");
+
+/* Stack id of one in stacks_idx submissions, -1 for the others.
+   Userspace deletes a stack once it has read it, until then a
+   different stack hashing to its bucket fails with -EEXIST rather than
+   replacing it under a record that still refers to it */
+static __always_inline int __sample_stack(void *tp_ctx) {
+  long every = __global(&stacks_idx);
+  int id;
+
+  if (every <= 0 || bpf_get_prandom_u32() % every != 0)
+    return -1;
+  id = bpf_get_stackid(tp_ctx, &stacks, BPF_F_USER_STACK);
+  if (id < 0)
+    __incr(&stack_fail_idx);
+  return id;
+}
+
+static __always_inline int __handle_submit(void *tp_ctx, void *ring, void *req,
+                                           u64 user_data, u8 opcode,
+                                           u32 flags, bool force_nonblock,
+                                           bool sq_thread) {
   struct event *e;
   struct io_uring_submit_sqe *extra;
 
-  unsigned op_str_off;
-
   __incr(&total_idx);
-  if (__filter_event(ctx->req))
+  /* The thread moves on to this request, even when it isn't traced the
+     previous one mustn't be charged for its bios */
+  __clear_issuing();
+  if (__filter_ring(ring) != 0)
     return 0;
-
-  /* bpf_printk("submit %d", ctx->req); */
-  e = __init_event(IO_URING_SUBMIT_SQE);
-  if (e == NULL)
+  if (__filter_submit(req) != 0)
     return 0;
+  __track_task();
+  __set_issuing(ring, req, opcode);
 
-  extra = &(e->io_uring_submit_sqe);
-  extra->ctx = ctx->ctx;
-  extra->req = ctx->req;
-  extra->opcode = ctx->opcode;
-  extra->flags = ctx->flags;
-  extra->sq_thread = ctx->sq_thread;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
+  if (__global(&hist_idx) != 0) {
+    __hist_submit(req, opcode);
+    return 0;
+  };
+  __watch_page_cache(req, opcode);
+
+  /* Slow mode fills in the held back record instead */
+  if (__global(&slow_idx) != 0) {
+    e = NULL;
+    extra = __slow_submit(req);
+    if (extra == NULL)
+      return 0;
+  } else {
+    e = __init_event(IO_URING_SUBMIT_SQE, sizeof(*extra));
+    if (e == NULL)
+      return 0;
+    extra = event_data(e);
+  };
 
-  bpf_ringbuf_submit(e, 0);
+  extra->ctx = ring;
+  extra->req = req;
+  extra->user_data = user_data;
+  extra->opcode = opcode;
+  extra->flags = flags;
+  extra->force_nonblock = force_nonblock;
+  extra->sq_thread = sq_thread;
+  extra->stack_id = __sample_stack(tp_ctx);
+
+  if (e != NULL)
+    __submit_event(e);
   return 0;
 }
 
+SEC("tp/io_uring/io_uring_submit_req")
+int handle_submit_req(struct trace_event_raw_io_uring_submit_req___new *ctx) {
+  /* Resolved at load time, the dead branch is pruned by the verifier */
+  if (!bpf_core_type_exists(struct trace_event_raw_io_uring_submit_req___new))
+    return 0;
+  return __handle_submit(ctx, ctx->ctx, ctx->req, ctx->user_data,
+                         ctx->opcode, ctx->flags, false, ctx->sq_thread);
+}
+
+SEC("tp/io_uring/io_uring_submit_sqe")
+int handle_submit_sqe(struct trace_event_raw_io_uring_submit_sqe___old *ctx) {
+  if (!bpf_core_type_exists(struct trace_event_raw_io_uring_submit_sqe___old))
+    return 0;
+  return __handle_submit(ctx, ctx->ctx, ctx->req, ctx->user_data,
+                         ctx->opcode, ctx->flags, ctx->force_nonblock,
+                         ctx->sq_thread);
+}
+
 SEC("tp/io_uring/io_uring_queue_async_work")
 int handle_queue_async_work(
     struct trace_event_raw_io_uring_queue_async_work *ctx) {
   struct event *e;
   struct io_uring_queue_async_work *extra;
-  unsigned op_str_off;
+  struct queued_work work = {};
+  u64 work_key;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
 
-  e = __init_event(IO_URING_QUEUE_ASYNC_WORK);
+  /* Recorded even if the event below is lost, the worker span only
+     needs this entry */
+  work_key = (u64)ctx->work;
+  work.ts = bpf_ktime_get_ns();
+  work.ctx = ctx->ctx;
+  work.req = ctx->req;
+  work.opcode = ctx->opcode;
+  bpf_map_update_elem(&queued_works, &work_key, &work, BPF_ANY);
+  if (__slow_step(IO_URING_QUEUE_ASYNC_WORK, ctx->req))
+    return 0;
+
+  e = __init_event(IO_URING_QUEUE_ASYNC_WORK, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_queue_async_work);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->opcode = ctx->opcode;
   extra->flags = ctx->flags;
   extra->work = ctx->work;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -231,27 +1251,28 @@ SEC("tp/io_uring/io_uring_poll_arm")
 int handle_poll_arm(struct trace_event_raw_io_uring_poll_arm *ctx) {
   struct event *e;
   struct io_uring_poll_arm *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_POLL_ARM, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_POLL_ARM);
+  e = __init_event(IO_URING_POLL_ARM, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_poll_arm);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->opcode = ctx->opcode;
   extra->mask = ctx->mask;
   extra->events = ctx->events;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -259,26 +1280,27 @@ SEC("tp/io_uring/io_uring_task_add")
 int handle_task_add(struct trace_event_raw_io_uring_task_add *ctx) {
   struct event *e;
   struct io_uring_task_add *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_TASK_ADD, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_TASK_ADD);
+  e = __init_event(IO_URING_TASK_ADD, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_task_add);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->mask = ctx->mask;
   extra->opcode = ctx->opcode;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -288,16 +1310,19 @@ int handle_task_work_run(struct trace_event_raw_io_uring_task_work_run *ctx) {
   struct io_uring_task_work_run *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_TASK_WORK_RUN);
+  if (__filter_task() != 0)
+    return 0;
+
+  e = __init_event(IO_URING_TASK_WORK_RUN, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_task_work_run);
+  extra = event_data(e);
   extra->tctx = ctx->tctx;
   extra->count = ctx->count;
   extra->loops = ctx->loops;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -307,17 +1332,20 @@ int handle_short_write(struct trace_event_raw_io_uring_short_write *ctx) {
   struct io_uring_short_write *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_SHORT_WRITE);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
+
+  e = __init_event(IO_URING_SHORT_WRITE, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_short_write);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->fpos = ctx->fpos;
   extra->wanted = ctx->wanted;
   extra->got = ctx->got;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -327,16 +1355,19 @@ int handle_local_work_run(struct trace_event_raw_io_uring_local_work_run *ctx) {
   struct io_uring_local_work_run *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_TASK_WORK_RUN);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
+
+  e = __init_event(IO_URING_LOCAL_WORK_RUN, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_local_work_run);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->count = ctx->count;
   extra->loops = ctx->loops;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -344,25 +1375,26 @@ SEC("tp/io_uring/io_uring_defer")
 int handle_defer(struct trace_event_raw_io_uring_defer *ctx) {
   struct event *e;
   struct io_uring_defer *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_DEFER, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_DEFER);
+  e = __init_event(IO_URING_DEFER, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_defer);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->data;
   extra->opcode = ctx->opcode;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -372,19 +1404,23 @@ int handle_link(struct trace_event_raw_io_uring_link *ctx) {
   struct io_uring_link *extra;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_LINK, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_LINK);
+  e = __init_event(IO_URING_LINK, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_link);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
   extra->target_req = ctx->target_req;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -392,26 +1428,27 @@ SEC("tp/io_uring/io_uring_fail_link")
 int handle_fail_link(struct trace_event_raw_io_uring_fail_link *ctx) {
   struct event *e;
   struct io_uring_fail_link *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_FAIL_LINK, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_FAIL_LINK);
+  e = __init_event(IO_URING_FAIL_LINK, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_fail_link);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->opcode = ctx->opcode;
   extra->link = ctx->link;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -421,15 +1458,18 @@ int handle_cqring_wait(struct trace_event_raw_io_uring_cqring_wait *ctx) {
   struct io_uring_cqring_wait *extra;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_CQRING_WAIT);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
+
+  e = __init_event(IO_URING_CQRING_WAIT, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_cqring_wait);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->min_events = ctx->min_events;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -437,19 +1477,23 @@ SEC("tp/io_uring/io_uring_req_failed")
 int handle_req_failed(struct trace_event_raw_io_uring_req_failed *ctx) {
   struct event *e;
   struct io_uring_req_failed *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  if (__slow_step(IO_URING_REQ_FAILED, ctx->req))
+    return 0;
 
-  e = __init_event(IO_URING_REQ_FAILED);
+  e = __init_event(IO_URING_REQ_FAILED, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_req_failed);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->opcode = ctx->opcode;
   extra->flags = ctx->flags;
   extra->ioprio = ctx->ioprio;
@@ -463,11 +1507,8 @@ int handle_req_failed(struct trace_event_raw_io_uring_req_failed *ctx) {
   extra->pad1 = ctx->pad1;
   extra->addr3 = ctx->addr3;
   extra->error = ctx->error;
-  op_str_off = ctx->__data_loc_op_str & 0xFFFF;
-  bpf_probe_read_str(&(extra->op_str), sizeof(extra->op_str),
-                     (void *)ctx + op_str_off);
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -475,21 +1516,23 @@ SEC("tp/io_uring/io_uring_cqe_overflow")
 int handle_cqe_overflow(struct trace_event_raw_io_uring_cqe_overflow *ctx) {
   struct event *e;
   struct io_uring_cqe_overflow *extra;
-  unsigned op_str_off;
 
   __incr(&total_idx);
-  e = __init_event(IO_URING_CQE_OVERFLOW);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
+
+  e = __init_event(IO_URING_CQE_OVERFLOW, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_cqe_overflow);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->user_data = ctx->user_data;
   extra->res = ctx->res;
   extra->cflags = ctx->cflags;
   extra->ocqe = ctx->ocqe;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -499,20 +1542,32 @@ int handle_complete(struct trace_event_raw_io_uring_complete *ctx) {
   struct io_uring_complete *extra;
 
   __incr(&total_idx);
+  if (__filter_ring(ctx->ctx) != 0)
+    return 0;
   if (__filter_event(ctx->req) != 0)
     return 0;
+  __forget_sampled(ctx->req, ctx->cflags);
 
-  e = __init_event(IO_URING_COMPLETE);
+  if (__global(&hist_idx) != 0) {
+    __hist_complete(ctx->ctx, ctx->req, ctx->cflags);
+    return 0;
+  };
+  if (__global(&slow_idx) != 0 && !__slow_complete(ctx->req, ctx->cflags))
+    return 0;
+  __send_page_cache(ctx->ctx, ctx->req, ctx->cflags);
+
+  e = __init_event(IO_URING_COMPLETE, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  extra = &(e->io_uring_complete);
+  extra = event_data(e);
   extra->ctx = ctx->ctx;
   extra->req = ctx->req;
+  extra->user_data = ctx->user_data;
   extra->res = ctx->res;
   extra->cflags = ctx->cflags;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -521,17 +1576,291 @@ int BPF_KPROBE(handle_io_init_new_worker, struct io_wq *wq,
                struct io_worker *worker, struct task_struct *tsk) {
   struct event *e;
   struct io_init_new_worker *extra;
+  int worker_tid;
 
   __incr(&total_idx);
-  e = __init_event(KPROBE_IO_INIT_NEW_WORKER);
-  if (e == NULL)
+  if (__filter_task() != 0)
     return 0;
 
   /* The kernel uses the PID slot here for what we semantically use
-     tid for */
-  extra = &(e->io_init_new_worker);
-  bpf_probe_read_kernel(&(extra->io_worker_tid), sizeof(int), &(tsk->pid));
-  bpf_ringbuf_submit(e, 0);
+     tid for. Workers belong to the thread group of the ring's owner */
+  bpf_probe_read_kernel(&worker_tid, sizeof(int), &(tsk->pid));
+  __track_tid(worker_tid, bpf_get_current_pid_tgid() >> 32);
+
+  e = __init_event(KPROBE_IO_INIT_NEW_WORKER, sizeof(*extra));
+  if (e == NULL)
+    return 0;
+
+  extra = event_data(e);
+  extra->io_worker_tid = worker_tid;
+  __submit_event(e);
+  return 0;
+}
+
+/* io_wq_submit_work runs a single piece of work on an io-wq worker,
+   fentry/fexit give the exact time the worker spends on it */
+SEC("fentry/io_wq_submit_work")
+int BPF_PROG(handle_io_wq_work_begin, struct io_wq_work *work) {
+  struct event *e;
+  struct io_wq_work_begin *extra;
+  struct queued_work *queued;
+  u64 key = (u64)work;
+
+  __incr(&total_idx);
+  queued = bpf_map_lookup_elem(&queued_works, &key);
+  if (queued == NULL) {
+    __incr(&unrelated_idx);
+    return 0;
+  }
+
+  /* Covers workers spawned before tracing started */
+  __track_task();
+  __set_issuing(queued->ctx, queued->req, queued->opcode);
+  __watch_page_cache(queued->req, queued->opcode);
+
+  e = __init_event(FENTRY_IO_WQ_SUBMIT_WORK, sizeof(*extra));
+  if (e == NULL)
+    return 0;
+
+  extra = event_data(e);
+  extra->ctx = queued->ctx;
+  extra->req = queued->req;
+  extra->work = work;
+  extra->queue_wait = e->ts - queued->ts;
+  extra->opcode = queued->opcode;
+
+  __submit_event(e);
+  return 0;
+}
+
+SEC("fexit/io_wq_submit_work")
+int BPF_PROG(handle_io_wq_work_end, struct io_wq_work *work) {
+  struct event *e;
+  struct io_wq_work_end *extra;
+  struct queued_work *queued;
+  u64 key = (u64)work;
+
+  __incr(&total_idx);
+  queued = bpf_map_lookup_elem(&queued_works, &key);
+  if (queued == NULL) {
+    __incr(&unrelated_idx);
+    return 0;
+  }
+
+  e = __init_event(FEXIT_IO_WQ_SUBMIT_WORK, sizeof(*extra));
+  if (e != NULL) {
+    extra = event_data(e);
+    extra->ctx = queued->ctx;
+    extra->req = queued->req;
+    extra->work = work;
+    extra->opcode = queued->opcode;
+    __submit_event(e);
+  }
+
+  bpf_map_delete_elem(&queued_works, &key);
+  __clear_issuing();
+  return 0;
+}
+
+#define PF_IO_WORKER 0x00000010
+
+/* Inline issue of a request is over, later bios of the submitting
+   thread aren't on its behalf. io-wq workers may issue their request
+   again, they keep it until their work ends */
+SEC("fexit/io_issue_sqe")
+int BPF_PROG(handle_issue_sqe_end) {
+  struct task_struct *task = bpf_get_current_task_btf();
+
+  if (task->flags & PF_IO_WORKER)
+    return 0;
+  __clear_issuing();
+  return 0;
+}
+
+/* Block layer probes, only attached with --block */
+SEC("tp_btf/block_bio_queue")
+int BPF_PROG(handle_block_bio_queue, struct bio *bio) {
+  u32 tid = bpf_get_current_pid_tgid();
+  struct req_ref *ref;
+  u64 key = (u64)bio;
+
+  ref = bpf_map_lookup_elem(&issuing, &tid);
+  if (ref != NULL)
+    bpf_map_update_elem(&bios, &key, ref, BPF_ANY);
+  return 0;
+}
+
+static int __block_rq_event(enum tracepoint_t ty, struct request *rq,
+                            struct req_ref *ref, int error) {
+  struct event *e;
+  struct block_rq *extra;
+
+  e = __init_event(ty, sizeof(*extra));
+  if (e == NULL)
+    return 0;
+
+  extra = event_data(e);
+  extra->ctx = ref->ctx;
+  extra->req = ref->req;
+  extra->rq = rq;
+  extra->sector = BPF_CORE_READ(rq, __sector);
+  extra->nr_bytes = BPF_CORE_READ(rq, __data_len);
+  extra->error = error;
+  extra->pid = ref->pid;
+
+  __submit_event(e);
+  return 0;
+}
+
+/* Looks up the io_uring request behind a block request, following its
+   first bio the first time it is seen */
+static struct req_ref *__block_rq_ref(struct request *rq) {
+  struct req_ref *ref;
+  u64 key = (u64)rq;
+  u64 bio;
+
+  ref = bpf_map_lookup_elem(&block_rqs, &key);
+  if (ref != NULL)
+    return ref;
+
+  bio = (u64)BPF_CORE_READ(rq, bio);
+  ref = bpf_map_lookup_elem(&bios, &bio);
+  if (ref == NULL)
+    return NULL;
+  bpf_map_update_elem(&block_rqs, &key, ref, BPF_ANY);
+  bpf_map_delete_elem(&bios, &bio);
+  return bpf_map_lookup_elem(&block_rqs, &key);
+}
+
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(handle_block_rq_insert, struct request *rq) {
+  struct req_ref *ref = __block_rq_ref(rq);
+
+  if (ref == NULL)
+    return 0;
+  __incr(&total_idx);
+  return __block_rq_event(BLOCK_RQ_INSERT, rq, ref, 0);
+}
+
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(handle_block_rq_issue, struct request *rq) {
+  struct req_ref *ref = __block_rq_ref(rq);
+
+  if (ref == NULL)
+    return 0;
+  __incr(&total_idx);
+  return __block_rq_event(BLOCK_RQ_ISSUE, rq, ref, 0);
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(handle_block_rq_complete, struct request *rq, int error,
+             unsigned int nr_bytes) {
+  struct req_ref *ref;
+  u64 key = (u64)rq;
+
+  ref = bpf_map_lookup_elem(&block_rqs, &key);
+  if (ref == NULL)
+    return 0;
+  __incr(&total_idx);
+  __block_rq_event(BLOCK_RQ_COMPLETE, rq, ref, error);
+  bpf_map_delete_elem(&block_rqs, &key);
+  return 0;
+}
+
+/* Page cache probes, only attached with the page_cache category. Page
+   cache activity of a thread is attributed to the request it is
+   issuing, like bios are */
+static void __count_page_cache(int added) {
+  u32 tid = bpf_get_current_pid_tgid();
+  struct page_cache_stats *stats;
+  struct req_ref *ref;
+  u64 key;
+
+  ref = bpf_map_lookup_elem(&issuing, &tid);
+  if (ref == NULL || !__is_read(ref->opcode))
+    return;
+  key = (u64)ref->req;
+  /* Gone once the request completed, or evicted */
+  stats = bpf_map_lookup_elem(&page_cache, &key);
+  if (stats == NULL)
+    return;
+  if (added)
+    __sync_fetch_and_add(&stats->added, 1);
+  else
+    __sync_fetch_and_add(&stats->accessed, 1);
+}
+
+/* Pages are only added to the page cache on a miss, by the
+   synchronous or asynchronous readahead it starts */
+SEC("tp/filemap/mm_filemap_add_to_page_cache")
+int handle_filemap_add(void *ctx) {
+  __count_page_cache(1);
+  return 0;
+}
+
+/* Reads mark the folios they find as accessed. Named
+   mark_page_accessed before folios, userspace attaches one of the two */
+SEC("kprobe/folio_mark_accessed")
+int handle_folio_mark_accessed(void *ctx) {
+  __count_page_cache(0);
+  return 0;
+}
+
+SEC("kprobe/mark_page_accessed")
+int handle_mark_page_accessed(void *ctx) {
+  __count_page_cache(0);
+  return 0;
+}
+
+/* Scheduler probes, only attached with --sched. They fire for every
+   task on the system, so nothing is counted until a tracked thread is
+   involved */
+SEC("tp/sched/sched_switch")
+int handle_sched_switch(struct trace_event_raw_sched_switch *ctx) {
+  struct event *e;
+  struct sched_switch *extra;
+  u32 prev_pid = __tracked_tgid(ctx->prev_pid);
+  u32 next_pid = __tracked_tgid(ctx->next_pid);
+
+  if (prev_pid == 0 && next_pid == 0)
+    return 0;
+  __incr(&total_idx);
+
+  e = __init_event(SCHED_SWITCH, sizeof(*extra));
+  if (e == NULL)
+    return 0;
+
+  extra = event_data(e);
+  extra->prev_pid = prev_pid;
+  extra->prev_tid = ctx->prev_pid;
+  extra->prev_state = ctx->prev_state;
+  extra->next_pid = next_pid;
+  extra->next_tid = ctx->next_pid;
+
+  __submit_event(e);
+  return 0;
+}
+
+SEC("tp/sched/sched_wakeup")
+int handle_sched_wakeup(struct trace_event_raw_sched_wakeup_template *ctx) {
+  struct event *e;
+  struct sched_wakeup *extra;
+  u32 pid = __tracked_tgid(ctx->pid);
+
+  if (pid == 0)
+    return 0;
+  __incr(&total_idx);
+
+  e = __init_event(SCHED_WAKEUP, sizeof(*extra));
+  if (e == NULL)
+    return 0;
+
+  extra = event_data(e);
+  extra->pid = pid;
+  extra->tid = ctx->pid;
+  extra->target_cpu = ctx->target_cpu;
+
+  __submit_event(e);
   return 0;
 }
 
@@ -540,11 +1869,14 @@ int handle_sys_enter_io_uring_setup(struct trace_event_raw_sys_enter *ctx) {
   struct event *e;
 
   __incr(&total_idx);
-  e = __init_event(SYS_ENTER_IO_URING_SETUP);
+  if (__filter_task() != 0)
+    return 0;
+
+  e = __init_event(SYS_ENTER_IO_URING_SETUP, 0);
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -553,11 +1885,14 @@ int handle_sys_exit_io_uring_setup(struct trace_event_raw_sys_enter *ctx) {
   struct event *e;
 
   __incr(&total_idx);
-  e = __init_event(SYS_EXIT_IO_URING_SETUP);
+  if (__filter_task() != 0)
+    return 0;
+
+  e = __init_event(SYS_EXIT_IO_URING_SETUP, 0);
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -566,11 +1901,14 @@ int handle_sys_enter_io_uring_register(struct trace_event_raw_sys_enter *ctx) {
   struct event *e;
 
   __incr(&total_idx);
-  e = __init_event(SYS_ENTER_IO_URING_REGISTER);
+  if (__filter_task() != 0)
+    return 0;
+
+  e = __init_event(SYS_ENTER_IO_URING_REGISTER, 0);
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
@@ -579,36 +1917,60 @@ int handle_sys_exit_io_uring_register(struct trace_event_raw_sys_enter *ctx) {
   struct event *e;
 
   __incr(&total_idx);
-  e = __init_event(SYS_EXIT_IO_URING_REGISTER);
+  if (__filter_task() != 0)
+    return 0;
+
+  e = __init_event(SYS_EXIT_IO_URING_REGISTER, 0);
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  __submit_event(e);
   return 0;
 }
 
 SEC("tp/syscalls/sys_enter_io_uring_enter")
 int handle_sys_enter_io_uring_enter(struct trace_event_raw_sys_enter *ctx) {
   struct event *e;
+  struct sys_enter_io_uring_enter *extra;
 
   __incr(&total_idx);
-  e = __init_event(SYS_ENTER_IO_URING_ENTER);
+  if (__filter_task() != 0)
+    return 0;
+  __enter_ring(ctx->args[0], ctx->args[3]);
+
+  e = __init_event(SYS_ENTER_IO_URING_ENTER, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  extra = event_data(e);
+  extra->fd = ctx->args[0];
+  extra->to_submit = ctx->args[1];
+  extra->min_complete = ctx->args[2];
+  extra->flags = ctx->args[3];
+
+  __submit_event(e);
   return 0;
 }
 
 SEC("tp/syscalls/sys_exit_io_uring_enter")
-int handle_sys_exit_io_uring_enter(struct trace_event_raw_sys_enter *ctx) {
+int handle_sys_exit_io_uring_enter(struct trace_event_raw_sys_exit *ctx) {
   struct event *e;
+  struct sys_exit_io_uring_enter *extra;
 
   __incr(&total_idx);
-  e = __init_event(SYS_EXIT_IO_URING_ENTER);
+  if (__filter_task() != 0)
+    return 0;
+  /* Later bios from this thread aren't issued on behalf of a request */
+  __clear_issuing();
+  __exit_ring();
+
+  e = __init_event(SYS_EXIT_IO_URING_ENTER, sizeof(*extra));
   if (e == NULL)
     return 0;
 
-  bpf_ringbuf_submit(e, 0);
+  extra = event_data(e);
+  extra->ret = ctx->ret;
+
+  __submit_event(e);
   return 0;
 }
@@ -3,7 +3,13 @@
 
 #include <stdbool.h>
 #define TASK_COMM_LEN 16
-#define MAX_OP_STR_LEN 127
+#define HIST_SLOTS 32
+/* Frames kept per sampled user stack, PERF_MAX_STACK_DEPTH */
+#define MAX_STACK_DEPTH 127
+/* Upper bound on the number of record types */
+#define MAX_TRACEPOINTS 64
+/* Ring buffers available to sharded mode, rb_0 .. rb_7 */
+#define MAX_SHARDS 8
 
 enum tracepoint_t {
   IO_URING_CREATE,
@@ -29,7 +35,50 @@ enum tracepoint_t {
   SYS_ENTER_IO_URING_REGISTER,
   SYS_EXIT_IO_URING_REGISTER,
   SYS_ENTER_IO_URING_ENTER,
-  SYS_EXIT_IO_URING_ENTER
+  SYS_EXIT_IO_URING_ENTER,
+  FENTRY_IO_WQ_SUBMIT_WORK,
+  FEXIT_IO_WQ_SUBMIT_WORK,
+  SCHED_SWITCH,
+  SCHED_WAKEUP,
+  BLOCK_RQ_INSERT,
+  BLOCK_RQ_ISSUE,
+  BLOCK_RQ_COMPLETE,
+  TASK_COMM,
+  LOST_EVENTS,
+  RING_SNAPSHOT,
+  SLOW_STEP,
+  RING_OCCUPANCY,
+  PAGE_CACHE,
+  /* Number of record types, not a record type */
+  NR_TRACEPOINTS
+};
+
+_Static_assert(NR_TRACEPOINTS <= MAX_TRACEPOINTS,
+               "lost_by_type needs a slot per record type");
+
+/* Value of the comm_filter map, also the payload of TASK_COMM records
+   that give the comm of a thread the first time it is seen */
+struct task_comm {
+  char comm[TASK_COMM_LEN];
+};
+
+/* Per-CPU state of the adaptive sampler */
+struct sample_state {
+  unsigned long long last_ts;
+  long last_lost;
+  unsigned int shift;
+};
+
+/* Latency histograms are kept per ring and opcode */
+struct hist_key {
+  unsigned long long ctx;
+  unsigned int opcode;
+};
+
+/* Slot i counts requests that took [2^i, 2^(i+1)) ns, the last slot
+   also takes anything slower */
+struct hist {
+  unsigned long long slots[HIST_SLOTS];
 };
 
 struct io_uring_create {
@@ -40,6 +89,18 @@ struct io_uring_create {
   unsigned long flags;
 };
 
+/* Ring that was already set up when tracing started, found by the
+   snapshot_rings iterator. Carries the comm of its owner since the
+   record isn't sent from that task */
+struct ring_snapshot {
+  int fd;
+  void *ctx;
+  unsigned int sq_entries;
+  unsigned int cq_entries;
+  unsigned int flags;
+  char comm[TASK_COMM_LEN];
+};
+
 struct io_uring_register {
   void *ctx;
   unsigned opcode;
@@ -51,51 +112,47 @@ struct io_uring_register {
 struct io_uring_file_get {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   int fd;
 };
 
 struct io_uring_submit_sqe {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   unsigned long flags;
   bool force_nonblock;
   bool sq_thread;
-  /* unsigned long __data_loc_op_str; */
-  char op_str[MAX_OP_STR_LEN];
+  /* Id in the stacks map, or negative when not sampled */
+  int stack_id;
 };
 
 struct io_uring_queue_async_work {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   unsigned int flags;
   void *work;
   /* int rw; */
-  /* unsigned long __data_loc_op_str; */
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_poll_arm {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   int mask;
   int events;
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_task_add {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   int mask;
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_task_work_run {
@@ -120,9 +177,8 @@ struct io_uring_local_work_run {
 struct io_uring_defer {
   void *ctx;
   void *req;
-  /* unsigned long long data; */
+  unsigned long long user_data;
   unsigned char opcode;
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_link {
@@ -135,10 +191,9 @@ struct io_uring_link {
 struct io_uring_fail_link {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   void *link;
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_cqring_wait {
@@ -149,7 +204,7 @@ struct io_uring_cqring_wait {
 struct io_uring_req_failed {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   unsigned char opcode;
   unsigned char flags;
   unsigned char ioprio;
@@ -163,7 +218,6 @@ struct io_uring_req_failed {
   unsigned long long pad1;
   unsigned long long addr3;
   int error;
-  char op_str[MAX_OP_STR_LEN];
 };
 
 struct io_uring_cqe_overflow {
@@ -177,7 +231,7 @@ struct io_uring_cqe_overflow {
 struct io_uring_complete {
   void *ctx;
   void *req;
-  /* unsigned long long user_data; */
+  unsigned long long user_data;
   int res;
   unsigned int cflags;
   /* unsigned long long extra1; */
@@ -188,40 +242,112 @@ struct io_init_new_worker {
   int io_worker_tid;
 };
 
-/* struct sys_enter_io_uring_enter { */
-/*     unsigned int fd; */
-/*     unsigned long to_submit; */
-/*     unsigned long min_complete; */
-/*     unsigned long flags; */
-/*     unsigned */
-/* } */
+/* An io-wq worker picking up punted work, queue_wait is the time since
+   io_uring_queue_async_work */
+struct io_wq_work_begin {
+  void *ctx;
+  void *req;
+  void *work;
+  unsigned long long queue_wait;
+  unsigned char opcode;
+};
+
+struct io_wq_work_end {
+  void *ctx;
+  void *req;
+  void *work;
+  unsigned char opcode;
+};
+
+/* A pid of 0 means that side of the switch isn't a tracked thread.
+   prev_state is the raw tracepoint value: 0 or TASK_REPORT_MAX when
+   the task is still runnable (yield or preemption) */
+struct sched_switch {
+  int prev_pid;
+  int prev_tid;
+  long prev_state;
+  int next_pid;
+  int next_tid;
+};
+
+struct sched_wakeup {
+  int pid;
+  int tid;
+  int target_cpu;
+};
+
+/* Block request attributed to an io_uring request, shared by the
+   insert, issue and complete records. pid is the tgid of the thread
+   that issued it, completions usually run in interrupt context */
+struct block_rq {
+  void *ctx;
+  void *req;
+  void *rq;
+  unsigned long long sector;
+  unsigned int nr_bytes;
+  int error;
+  int pid;
+};
+
+/* Marker for count records lost on this CPU since the since
+   timestamp */
+struct lost_events {
+  unsigned long long count;
+  unsigned long long since;
+};
+
+/* Intermediate event of a slow request, held back in the kernel until
+   the request completed. The header has the thread and time of the
+   event, step its tracepoint type */
+struct slow_step {
+  void *ctx;
+  void *req;
+  enum tracepoint_t step;
+};
 
+/* Head and tail indices of the SQ and CQ of a ring. They wrap around,
+   the number of entries is tail - head */
+struct ring_occupancy {
+  void *ctx;
+  unsigned int sq_head;
+  unsigned int sq_tail;
+  unsigned int cq_head;
+  unsigned int cq_tail;
+  unsigned int sq_entries;
+  unsigned int cq_entries;
+};
+
+/* Page cache activity while a request was being issued: folios it
+   found cached and pages added by the readahead that its misses
+   started */
+struct page_cache_stats {
+  void *ctx;
+  void *req;
+  unsigned long long accessed;
+  unsigned long long added;
+};
+
+/* Arguments of io_uring_enter(2), argp/argsz are left out */
+struct sys_enter_io_uring_enter {
+  unsigned int fd;
+  unsigned int to_submit;
+  unsigned int min_complete;
+  unsigned int flags;
+};
+
+/* Number of SQEs consumed, or a negative errno */
+struct sys_exit_io_uring_enter {
+  long ret;
+};
+
+/* Common header of every record in the ring buffer. It is directly
+   followed by the payload struct of its tracepoint type, records are
+   sized for exactly that payload */
 struct event {
   enum tracepoint_t ty;
   int pid;
   int tid;
   unsigned long long ts;
-  char comm[TASK_COMM_LEN];
-  union {
-    struct io_uring_create io_uring_create;
-    struct io_uring_register io_uring_register;
-    struct io_uring_file_get io_uring_file_get;
-    struct io_uring_submit_sqe io_uring_submit_sqe;
-    struct io_uring_queue_async_work io_uring_queue_async_work;
-    struct io_uring_poll_arm io_uring_poll_arm;
-    struct io_uring_task_add io_uring_task_add;
-    struct io_uring_task_work_run io_uring_task_work_run;
-    struct io_uring_short_write io_uring_short_write;
-    struct io_uring_local_work_run io_uring_local_work_run;
-    struct io_uring_defer io_uring_defer;
-    struct io_uring_link io_uring_link;
-    struct io_uring_fail_link io_uring_fail_link;
-    struct io_uring_cqring_wait io_uring_cqring_wait;
-    struct io_uring_req_failed io_uring_req_failed;
-    struct io_uring_cqe_overflow io_uring_cqe_overflow;
-    struct io_uring_complete io_uring_complete;
-    struct io_init_new_worker io_init_new_worker;
-  };
 };
 
 /* enum io_uring_op { */
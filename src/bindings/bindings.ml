@@ -27,8 +27,84 @@ let string_of_flag_list l show =
   if l = [] then "None" else List.map show l |> String.concat " | "
 
 let () =
-  assert (C.(Defines.max_op_str_len = max_op_str_len));
-  assert (C.(Defines.task_comm_len = task_comm_len))
+  assert (C.(Defines.task_comm_len = task_comm_len));
+  assert (C.(Defines.hist_slots = hist_slots));
+  assert (C.(Defines.max_stack_depth = max_stack_depth));
+  assert (C.(Defines.max_shards = max_shards));
+  assert (C.(Defines.max_tracepoints = max_tracepoints));
+  (* Every record type is known here and has a slot in lost_by_type *)
+  assert (C.(nr_tracepoints = List.length tracepoints));
+  assert (C.(nr_tracepoints <= max_tracepoints))
+
+(* The kernel resolves opcodes to names with io_uring_get_opcode. We
+   only ship the opcode across and do the same lookup here *)
+module Opcode = struct
+  let names =
+    [|
+      "NOP";
+      "READV";
+      "WRITEV";
+      "FSYNC";
+      "READ_FIXED";
+      "WRITE_FIXED";
+      "POLL_ADD";
+      "POLL_REMOVE";
+      "SYNC_FILE_RANGE";
+      "SENDMSG";
+      "RECVMSG";
+      "TIMEOUT";
+      "TIMEOUT_REMOVE";
+      "ACCEPT";
+      "ASYNC_CANCEL";
+      "LINK_TIMEOUT";
+      "CONNECT";
+      "FALLOCATE";
+      "OPENAT";
+      "CLOSE";
+      "FILES_UPDATE";
+      "STATX";
+      "READ";
+      "WRITE";
+      "FADVISE";
+      "MADVISE";
+      "SEND";
+      "RECV";
+      "OPENAT2";
+      "EPOLL_CTL";
+      "SPLICE";
+      "PROVIDE_BUFFERS";
+      "REMOVE_BUFFERS";
+      "TEE";
+      "SHUTDOWN";
+      "RENAMEAT";
+      "UNLINKAT";
+      "MKDIRAT";
+      "SYMLINKAT";
+      "LINKAT";
+      "MSG_RING";
+      "FSETXATTR";
+      "SETXATTR";
+      "FGETXATTR";
+      "GETXATTR";
+      "SOCKET";
+      "URING_CMD";
+      "SEND_ZC";
+      "SENDMSG_ZC";
+      "READ_MULTISHOT";
+      "WAITID";
+      "FUTEX_WAIT";
+      "FUTEX_WAKE";
+      "FUTEX_WAITV";
+      "FIXED_FD_INSTALL";
+      "FTRUNCATE";
+      "BIND";
+      "LISTEN";
+    |]
+
+  let show opcode =
+    if opcode >= 0 && opcode < Array.length names then names.(opcode)
+    else "INVALID"
+end
 
 module Setup_flags = struct
   let setup_flag_assoc =
@@ -93,6 +169,24 @@ module Cqe_flags = struct
   let show flags = string_of_flag_list flags show_cqe_flags
 end
 
+module Enter_flags = struct
+  let enter_flag_assoc =
+    C.Sys_enter_io_uring_enter.Flags.
+      [
+        (GETEVENTS, getevents);
+        (SQ_WAKEUP, sq_wakeup);
+        (SQ_WAIT, sq_wait);
+        (EXT_ARG, ext_arg);
+        (REGISTERED_RING, registered_ring);
+      ]
+
+  let read i64 =
+    flags_of_i64 i64 (List.map (fun (i, f) -> (f, i)) enter_flag_assoc)
+
+  let write flags = i64_of_flags flags enter_flag_assoc
+  let show flags = string_of_flag_list flags show_enter_flags
+end
+
 type io_uring_create = {
   fd : int;
   ctx_ptr : unit ptr;
@@ -110,6 +204,18 @@ let unload_create s =
   let flags = getf s flags |> Unsigned.UInt32.to_int64 |> Setup_flags.read in
   { fd; ctx_ptr; sq_entries; cq_entries; flags }
 
+type ring_snapshot = { ring : io_uring_create; comm : string }
+
+let unload_ring_snapshot s =
+  let open C.Ring_snapshot in
+  let fd = getf s fd in
+  let ctx_ptr = getf s ctx in
+  let cq_entries = getf s cq_entries |> Unsigned.UInt32.to_int32 in
+  let sq_entries = getf s sq_entries |> Unsigned.UInt32.to_int32 in
+  let flags = getf s flags |> Unsigned.UInt32.to_int64 |> Setup_flags.read in
+  let comm = getf s comm |> char_array_as_string in
+  { ring = { fd; ctx_ptr; sq_entries; cq_entries; flags }; comm }
+
 type register = {
   ctx_ptr : unit ptr;
   opcode : int32;
@@ -127,90 +233,107 @@ let unload_register s =
   let ret = getf s ret in
   { ctx_ptr; opcode; nr_files; nr_bufs; ret }
 
-type io_uring_file_get = { ctx_ptr : unit ptr; req_ptr : unit ptr; fd : int }
+type io_uring_file_get = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  user_data : int64;
+  fd : int;
+}
 
 let unload_file_get s =
   let open C.File_get in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let fd = getf s fd in
-  { ctx_ptr; req_ptr; fd }
+  { ctx_ptr; req_ptr; user_data; fd }
 
 type io_uring_submit_sqe = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   flags : sqe_flags list;
   force_nonblock : bool;
   sq_thread : bool;
-  op_str : string;
+  stack_id : int;
 }
 
 let unload_submit_sqe s =
   let open C.Submit_sqe in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let flags = getf s flags |> Unsigned.ULong.to_int64 |> Sqe_flags.read in
   let force_nonblock = getf s force_nonblock in
   let sq_thread = getf s sq_thread in
-  let op_str = getf s op_str |> char_array_as_string in
-  { req_ptr; ctx_ptr; opcode; flags; force_nonblock; sq_thread; op_str }
+  let stack_id = getf s stack_id in
+  {
+    req_ptr;
+    user_data;
+    ctx_ptr;
+    opcode;
+    flags;
+    force_nonblock;
+    sq_thread;
+    stack_id;
+  }
 
 type io_uring_queue_async_work = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   flags : int32;
   work_ptr : unit ptr;
-  op_str : string;
 }
 
 let unload_queue_async_work s =
   let open C.Queue_async_work in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let flags = getf s flags |> Unsigned.UInt32.to_int32 in
   let work_ptr = getf s work |> to_voidp in
-  let op_str = getf s op_str |> char_array_as_string in
-  { ctx_ptr; req_ptr; opcode; flags; work_ptr; op_str }
+  { ctx_ptr; req_ptr; user_data; opcode; flags; work_ptr }
 
 type poll_arm = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   mask : int;
   events : int;
-  op_str : string;
 }
 
 let unload_poll_arm s =
   let open C.Poll_arm in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let mask = getf s mask in
   let events = getf s events in
-  let op_str = getf s op_str |> char_array_as_string in
-  { ctx_ptr; req_ptr; opcode; mask; events; op_str }
+  { ctx_ptr; req_ptr; user_data; opcode; mask; events }
 
 type task_add = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   mask : int;
-  op_str : string;
 }
 
 let unload_task_add s =
   let open C.Task_add in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let mask = getf s mask in
-  let op_str = getf s op_str |> char_array_as_string in
-  { ctx_ptr; req_ptr; opcode; mask; op_str }
+  { ctx_ptr; req_ptr; user_data; opcode; mask }
 
 type task_work_run = { tctx_ptr : unit ptr; count : int; loops : int }
 
@@ -248,17 +371,17 @@ let unload_local_work_run s =
 type defer = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
-  op_str : string;
 }
 
 let unload_defer s =
   let open C.Defer in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
-  let op_str = getf s op_str |> char_array_as_string in
-  { ctx_ptr; req_ptr; opcode; op_str }
+  { ctx_ptr; req_ptr; user_data; opcode }
 
 type link = {
   ctx_ptr : unit ptr;
@@ -276,19 +399,19 @@ let unload_link s =
 type fail_link = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   link_ptr : unit ptr;
-  op_str : string;
 }
 
 let unload_fail_link s =
   let open C.Fail_link in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let link_ptr = getf s link in
-  let op_str = getf s op_str |> char_array_as_string in
-  { ctx_ptr; req_ptr; opcode; link_ptr; op_str }
+  { ctx_ptr; req_ptr; user_data; opcode; link_ptr }
 
 type cqring_wait = { ctx_ptr : unit ptr; min_events : int }
 
@@ -301,6 +424,7 @@ let unload_cqring_wait s =
 type req_failed = {
   ctx_ptr : unit ptr;
   req_ptr : unit ptr;
+  user_data : int64;
   opcode : int;
   flags : int;
   ioprio : int;
@@ -314,13 +438,13 @@ type req_failed = {
   pad1 : int64;
   addr3 : int64;
   error : int;
-  op_str : string;
 }
 
 let unload_req_failed s =
   let open C.Req_failed in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let opcode = getf s opcode |> Unsigned.UChar.to_int in
   let flags = getf s flags |> Unsigned.UChar.to_int in
   let ioprio = getf s ioprio |> Unsigned.UChar.to_int in
@@ -334,10 +458,10 @@ let unload_req_failed s =
   let pad1 = getf s pad1 |> Unsigned.ULLong.to_int64 in
   let addr3 = getf s addr3 |> Unsigned.ULLong.to_int64 in
   let error = getf s error in
-  let op_str = getf s op_str |> char_array_as_string in
   {
     ctx_ptr;
     req_ptr;
+    user_data;
     opcode;
     flags;
     ioprio;
@@ -351,7 +475,6 @@ let unload_req_failed s =
     pad1;
     addr3;
     error;
-    op_str;
   }
 
 type cqe_overflow = {
@@ -373,6 +496,7 @@ let unload_cqe_overflow s =
 
 type complete = {
   req_ptr : unit ptr;
+  user_data : int64;
   ctx_ptr : unit ptr;
   res : int;
   cflags : cqe_flags list;
@@ -382,23 +506,187 @@ let unload_complete s =
   let open C.Complete in
   let ctx_ptr = getf s ctx in
   let req_ptr = getf s req in
+  let user_data = getf s user_data |> Unsigned.ULLong.to_int64 in
   let res = getf s res in
   let cflags = getf s cflags |> Unsigned.UInt.to_int64 |> Cqe_flags.read in
-  { ctx_ptr; req_ptr; res; cflags }
+  { ctx_ptr; req_ptr; user_data; res; cflags }
+
+type io_wq_work_begin = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  work_ptr : unit ptr;
+  queue_wait : int64;
+  opcode : int;
+}
+
+let unload_io_wq_work_begin s =
+  let open C.Io_wq_work_begin in
+  let ctx_ptr = getf s ctx in
+  let req_ptr = getf s req in
+  let work_ptr = getf s work in
+  let queue_wait = getf s queue_wait |> Unsigned.ULLong.to_int64 in
+  let opcode = getf s opcode |> Unsigned.UChar.to_int in
+  { ctx_ptr; req_ptr; work_ptr; queue_wait; opcode }
+
+type io_wq_work_end = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  work_ptr : unit ptr;
+  opcode : int;
+}
+
+let unload_io_wq_work_end s =
+  let open C.Io_wq_work_end in
+  let ctx_ptr = getf s ctx in
+  let req_ptr = getf s req in
+  let work_ptr = getf s work in
+  let opcode = getf s opcode |> Unsigned.UChar.to_int in
+  { ctx_ptr; req_ptr; work_ptr; opcode }
+
+type sched_switch = {
+  prev_pid : int;
+  prev_tid : int;
+  prev_state : int64;
+  next_pid : int;
+  next_tid : int;
+}
+
+let unload_sched_switch s =
+  let open C.Sched_switch in
+  let prev_pid = getf s prev_pid in
+  let prev_tid = getf s prev_tid in
+  let prev_state = getf s prev_state |> Signed.Long.to_int64 in
+  let next_pid = getf s next_pid in
+  let next_tid = getf s next_tid in
+  { prev_pid; prev_tid; prev_state; next_pid; next_tid }
+
+type sched_wakeup = { pid : int; tid : int; target_cpu : int }
+
+let unload_sched_wakeup s =
+  let open C.Sched_wakeup in
+  let pid = getf s pid in
+  let tid = getf s tid in
+  let target_cpu = getf s target_cpu in
+  { pid; tid; target_cpu }
+
+type block_rq = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  rq_ptr : unit ptr;
+  sector : int64;
+  nr_bytes : int;
+  error : int;
+  pid : int;
+}
+
+let unload_block_rq s =
+  let open C.Block_rq in
+  let ctx_ptr = getf s ctx in
+  let req_ptr = getf s req in
+  let rq_ptr = getf s rq in
+  let sector = getf s sector |> Unsigned.ULLong.to_int64 in
+  let nr_bytes = getf s nr_bytes |> Unsigned.UInt.to_int in
+  let error = getf s error in
+  let pid = getf s pid in
+  { ctx_ptr; req_ptr; rq_ptr; sector; nr_bytes; error; pid }
+
+type sys_enter_io_uring_enter = {
+  fd : int;
+  to_submit : int;
+  min_complete : int;
+  flags : enter_flags list;
+}
+
+let unload_sys_enter_io_uring_enter s =
+  let open C.Sys_enter_io_uring_enter in
+  let fd = getf s fd |> Unsigned.UInt.to_int in
+  let to_submit = getf s to_submit |> Unsigned.UInt.to_int in
+  let min_complete = getf s min_complete |> Unsigned.UInt.to_int in
+  let flags = getf s flags |> Unsigned.UInt.to_int64 |> Enter_flags.read in
+  { fd; to_submit; min_complete; flags }
+
+type sys_exit_io_uring_enter = { ret : int64 }
+
+let unload_sys_exit_io_uring_enter s =
+  let open C.Sys_exit_io_uring_enter in
+  let ret = getf s ret |> Signed.Long.to_int64 in
+  { ret }
+
+type lost_events = { count : int64; since : int64 }
+
+let unload_lost_events s =
+  let open C.Lost_events in
+  let count = getf s count |> Unsigned.ULLong.to_int64 in
+  let since = getf s since |> Unsigned.ULLong.to_int64 in
+  { count; since }
+
+type slow_step = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  step : tracepoint_t;
+}
+
+let unload_slow_step s =
+  let open C.Slow_step in
+  let ctx_ptr = getf s ctx in
+  let req_ptr = getf s req in
+  let step = getf s step in
+  { ctx_ptr; req_ptr; step }
+
+(* Number of entries in each queue, indices are free running u32s *)
+type ring_occupancy = {
+  ctx_ptr : unit ptr;
+  sq_depth : int;
+  cq_depth : int;
+  sq_entries : int;
+  cq_entries : int;
+}
+
+let unload_ring_occupancy s =
+  let open C.Ring_occupancy in
+  let get f = getf s f |> Unsigned.UInt.to_int in
+  let depth head tail = (get tail - get head) land 0xffff_ffff in
+  let ctx_ptr = getf s ctx in
+  let sq_depth = depth sq_head sq_tail in
+  let cq_depth = depth cq_head cq_tail in
+  let sq_entries = get sq_entries in
+  let cq_entries = get cq_entries in
+  { ctx_ptr; sq_depth; cq_depth; sq_entries; cq_entries }
+
+type page_cache_stats = {
+  ctx_ptr : unit ptr;
+  req_ptr : unit ptr;
+  accessed : int64;
+  added : int64;
+}
+
+let unload_page_cache_stats s =
+  let open C.Page_cache_stats in
+  let ctx_ptr = getf s ctx in
+  let req_ptr = getf s req in
+  let accessed = getf s accessed |> Unsigned.ULLong.to_int64 in
+  let added = getf s added |> Unsigned.ULLong.to_int64 in
+  { ctx_ptr; req_ptr; accessed; added }
+
+let unload_task_comm s = getf s C.Task_comm.comm |> char_array_as_string
 
 type event = {
   ty : tracepoint_t;
   pid : int;
   tid : int;
   ts : Unsigned.uint64;
-  comm : string;
 }
 
+(* Records are a C.Event.t header directly followed by the payload
+   struct of their tracepoint type *)
+let payload typ data =
+  let p = from_voidp char data +@ sizeof C.Event.t in
+  !@(from_voidp typ (to_voidp p))
+
 let unload_event s =
   let open C.Event in
   let ty = getf s ty in
   let pid = getf s pid in
   let tid = getf s tid in
   let ts = getf s ts in
-  let comm = getf s comm |> char_array_as_string in
-  { ty; pid; tid; ts; comm }
+  { ty; pid; tid; ts }
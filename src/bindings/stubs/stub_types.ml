@@ -92,6 +92,10 @@ type sqe_flags =
 type cqe_flags = BUFFER | MORE | SOCK_NONEMPTY | NOTIF
 [@@deriving show { with_path = false }]
 
+(* io_uring_enter(2) flags, IORING_ENTER_* *)
+type enter_flags = GETEVENTS | SQ_WAKEUP | SQ_WAIT | EXT_ARG | REGISTERED_RING
+[@@deriving show { with_path = false }]
+
 type tracepoint_t =
   | IO_URING_CREATE
   | IO_URING_REGISTER
@@ -117,4 +121,17 @@ type tracepoint_t =
   | SYS_EXIT_IO_URING_REGISTER
   | SYS_ENTER_IO_URING_ENTER
   | SYS_EXIT_IO_URING_ENTER
+  | FENTRY_IO_WQ_SUBMIT_WORK
+  | FEXIT_IO_WQ_SUBMIT_WORK
+  | SCHED_SWITCH
+  | SCHED_WAKEUP
+  | BLOCK_RQ_INSERT
+  | BLOCK_RQ_ISSUE
+  | BLOCK_RQ_COMPLETE
+  | TASK_COMM
+  | LOST_EVENTS
+  | RING_SNAPSHOT
+  | SLOW_STEP
+  | RING_OCCUPANCY
+  | PAGE_CACHE
 [@@deriving show { with_path = false }]
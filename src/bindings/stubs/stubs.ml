@@ -11,44 +11,100 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
 
   module Defines = struct
     let task_comm_len = 16
-    let max_op_str_len = 127
+    let hist_slots = 32
+    let max_stack_depth = 127
+    let max_shards = 8
+    let max_tracepoints = 64
   end
 
   let task_comm_len = constant "TASK_COMM_LEN" int
-  let max_op_str_len = constant "MAX_OP_STR_LEN" int
+  let hist_slots = constant "HIST_SLOTS" int
+  let max_stack_depth = constant "MAX_STACK_DEPTH" int
+  let max_shards = constant "MAX_SHARDS" int
+  let max_tracepoints = constant "MAX_TRACEPOINTS" int
 
   let enum_gen ?typedef ?(prefix = "") label vals =
     enum ?typedef label
       (List.map (fun (a, b) -> (a, constant (prefix ^ b) int64_t)) vals)
 
-  let enum_tracepoint_t =
-    enum_gen "tracepoint_t"
-      [
-        (IO_URING_CREATE, "IO_URING_CREATE");
-        (IO_URING_REGISTER, "IO_URING_REGISTER");
-        (IO_URING_FILE_GET, "IO_URING_FILE_GET");
-        (IO_URING_SUBMIT_SQE, "IO_URING_SUBMIT_SQE");
-        (IO_URING_QUEUE_ASYNC_WORK, "IO_URING_QUEUE_ASYNC_WORK");
-        (IO_URING_POLL_ARM, "IO_URING_POLL_ARM");
-        (IO_URING_TASK_ADD, "IO_URING_TASK_ADD");
-        (IO_URING_TASK_WORK_RUN, "IO_URING_TASK_WORK_RUN");
-        (IO_URING_SHORT_WRITE, "IO_URING_SHORT_WRITE");
-        (IO_URING_LOCAL_WORK_RUN, "IO_URING_LOCAL_WORK_RUN");
-        (IO_URING_DEFER, "IO_URING_DEFER");
-        (IO_URING_LINK, "IO_URING_LINK");
-        (IO_URING_FAIL_LINK, "IO_URING_FAIL_LINK");
-        (IO_URING_CQRING_WAIT, "IO_URING_CQRING_WAIT");
-        (IO_URING_REQ_FAILED, "IO_URING_REQ_FAILED");
-        (IO_URING_CQE_OVERFLOW, "IO_URING_CQE_OVERFLOW");
-        (IO_URING_COMPLETE, "IO_URING_COMPLETE");
-        (KPROBE_IO_INIT_NEW_WORKER, "KPROBE_IO_INIT_NEW_WORKER");
-        (SYS_ENTER_IO_URING_SETUP, "SYS_ENTER_IO_URING_SETUP");
-        (SYS_EXIT_IO_URING_SETUP, "SYS_EXIT_IO_URING_SETUP");
-        (SYS_ENTER_IO_URING_REGISTER, "SYS_ENTER_IO_URING_REGISTER");
-        (SYS_EXIT_IO_URING_REGISTER, "SYS_EXIT_IO_URING_REGISTER");
-        (SYS_ENTER_IO_URING_ENTER, "SYS_ENTER_IO_URING_ENTER");
-        (SYS_EXIT_IO_URING_ENTER, "SYS_EXIT_IO_URING_ENTER");
-      ]
+  let tracepoints =
+    [
+      (IO_URING_CREATE, "IO_URING_CREATE");
+      (IO_URING_REGISTER, "IO_URING_REGISTER");
+      (IO_URING_FILE_GET, "IO_URING_FILE_GET");
+      (IO_URING_SUBMIT_SQE, "IO_URING_SUBMIT_SQE");
+      (IO_URING_QUEUE_ASYNC_WORK, "IO_URING_QUEUE_ASYNC_WORK");
+      (IO_URING_POLL_ARM, "IO_URING_POLL_ARM");
+      (IO_URING_TASK_ADD, "IO_URING_TASK_ADD");
+      (IO_URING_TASK_WORK_RUN, "IO_URING_TASK_WORK_RUN");
+      (IO_URING_SHORT_WRITE, "IO_URING_SHORT_WRITE");
+      (IO_URING_LOCAL_WORK_RUN, "IO_URING_LOCAL_WORK_RUN");
+      (IO_URING_DEFER, "IO_URING_DEFER");
+      (IO_URING_LINK, "IO_URING_LINK");
+      (IO_URING_FAIL_LINK, "IO_URING_FAIL_LINK");
+      (IO_URING_CQRING_WAIT, "IO_URING_CQRING_WAIT");
+      (IO_URING_REQ_FAILED, "IO_URING_REQ_FAILED");
+      (IO_URING_CQE_OVERFLOW, "IO_URING_CQE_OVERFLOW");
+      (IO_URING_COMPLETE, "IO_URING_COMPLETE");
+      (KPROBE_IO_INIT_NEW_WORKER, "KPROBE_IO_INIT_NEW_WORKER");
+      (SYS_ENTER_IO_URING_SETUP, "SYS_ENTER_IO_URING_SETUP");
+      (SYS_EXIT_IO_URING_SETUP, "SYS_EXIT_IO_URING_SETUP");
+      (SYS_ENTER_IO_URING_REGISTER, "SYS_ENTER_IO_URING_REGISTER");
+      (SYS_EXIT_IO_URING_REGISTER, "SYS_EXIT_IO_URING_REGISTER");
+      (SYS_ENTER_IO_URING_ENTER, "SYS_ENTER_IO_URING_ENTER");
+      (SYS_EXIT_IO_URING_ENTER, "SYS_EXIT_IO_URING_ENTER");
+      (FENTRY_IO_WQ_SUBMIT_WORK, "FENTRY_IO_WQ_SUBMIT_WORK");
+      (FEXIT_IO_WQ_SUBMIT_WORK, "FEXIT_IO_WQ_SUBMIT_WORK");
+      (SCHED_SWITCH, "SCHED_SWITCH");
+      (SCHED_WAKEUP, "SCHED_WAKEUP");
+      (BLOCK_RQ_INSERT, "BLOCK_RQ_INSERT");
+      (BLOCK_RQ_ISSUE, "BLOCK_RQ_ISSUE");
+      (BLOCK_RQ_COMPLETE, "BLOCK_RQ_COMPLETE");
+      (TASK_COMM, "TASK_COMM");
+      (LOST_EVENTS, "LOST_EVENTS");
+      (RING_SNAPSHOT, "RING_SNAPSHOT");
+      (SLOW_STEP, "SLOW_STEP");
+      (RING_OCCUPANCY, "RING_OCCUPANCY");
+      (PAGE_CACHE, "PAGE_CACHE");
+    ]
+
+  let enum_tracepoint_t = enum_gen "tracepoint_t" tracepoints
+  let nr_tracepoints = constant "NR_TRACEPOINTS" int
+
+  (* Values of the enum, as used to index per-type maps *)
+  let tracepoint_indices =
+    List.map (fun (ty, name) -> (ty, constant name int)) tracepoints
+
+  module Task_comm = struct
+    let t = structure "task_comm"
+    let ( -: ) ty label = field t label ty
+    let comm = array Defines.task_comm_len char -: "comm"
+    let _ = seal (t : [ `Task_comm ] structure typ)
+  end
+
+  module Sample_state = struct
+    let t = structure "sample_state"
+    let ( -: ) ty label = field t label ty
+    let last_ts = ullong -: "last_ts"
+    let last_lost = long -: "last_lost"
+    let shift = uint -: "shift"
+    let _ = seal (t : [ `Sample_state ] structure typ)
+  end
+
+  module Hist_key = struct
+    let t = structure "hist_key"
+    let ( -: ) ty label = field t label ty
+    let ctx = ullong -: "ctx"
+    let opcode = uint -: "opcode"
+    let _ = seal (t : [ `Hist_key ] structure typ)
+  end
+
+  module Hist = struct
+    let t = structure "hist"
+    let ( -: ) ty label = field t label ty
+    let slots = array Defines.hist_slots ullong -: "slots"
+    let _ = seal (t : [ `Hist ] structure typ)
+  end
 
   module Create = struct
     let t = structure "io_uring_create"
@@ -80,6 +136,18 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     end
   end
 
+  module Ring_snapshot = struct
+    let t = structure "ring_snapshot"
+    let ( -: ) ty label = field t label ty
+    let fd = int -: "fd"
+    let ctx = ptr void -: "ctx"
+    let sq_entries = uint32_t -: "sq_entries"
+    let cq_entries = uint32_t -: "cq_entries"
+    let flags = uint32_t -: "flags"
+    let comm = array Defines.task_comm_len char -: "comm"
+    let _ = seal (t : [ `Ring_snapshot ] structure typ)
+  end
+
   module Register = struct
     let t = structure "io_uring_register"
     let ( -: ) ty label = field t label ty
@@ -96,6 +164,7 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let fd = int -: "fd"
     let _ = seal (t : [ `File_get ] Ctypes.structure typ)
   end
@@ -105,11 +174,12 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let flags = ulong -: "flags"
     let force_nonblock = bool -: "force_nonblock"
     let sq_thread = bool -: "sq_thread"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
+    let stack_id = int -: "stack_id"
     let _ = seal (t : [ `Submit_sqe ] Ctypes.structure typ)
 
     module Flags = struct
@@ -130,10 +200,10 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let flags = uint32_t -: "flags"
     let work = ptr void -: "work"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Queue_async_work ] Ctypes.structure typ)
   end
 
@@ -142,10 +212,10 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let mask = int -: "mask"
     let events = int -: "events"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Poll_arm ] Ctypes.structure typ)
   end
 
@@ -154,9 +224,9 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let mask = int -: "mask"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Task_add ] Ctypes.structure typ)
   end
 
@@ -193,8 +263,8 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Defer ] Ctypes.structure typ)
   end
 
@@ -212,9 +282,9 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let link = ptr void -: "link"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Fail_link ] Ctypes.structure typ)
   end
 
@@ -231,6 +301,7 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let opcode = uchar -: "opcode"
     let flags = uchar -: "flags"
     let ioprio = uchar -: "ioprio"
@@ -244,7 +315,6 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let pad1 = ullong -: "pad1"
     let addr3 = ullong -: "addr3"
     let error = int -: "error"
-    let op_str = array Defines.max_op_str_len char -: "op_str"
     let _ = seal (t : [ `Req_failed ] Ctypes.structure typ)
   end
 
@@ -264,6 +334,7 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let ( -: ) ty label = field t label ty
     let ctx = ptr void -: "ctx"
     let req = ptr void -: "req"
+    let user_data = ullong -: "user_data"
     let res = int -: "res"
     let cflags = uint -: "cflags"
     let _ = seal (t : [ `Complete ] Ctypes.structure typ)
@@ -285,6 +356,127 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let _ = seal (t : [ `Io_init_new_worker ] Ctypes.structure typ)
   end
 
+  module Io_wq_work_begin = struct
+    let t = structure "io_wq_work_begin"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let req = ptr void -: "req"
+    let work = ptr void -: "work"
+    let queue_wait = ullong -: "queue_wait"
+    let opcode = uchar -: "opcode"
+    let _ = seal (t : [ `Io_wq_work_begin ] Ctypes.structure typ)
+  end
+
+  module Io_wq_work_end = struct
+    let t = structure "io_wq_work_end"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let req = ptr void -: "req"
+    let work = ptr void -: "work"
+    let opcode = uchar -: "opcode"
+    let _ = seal (t : [ `Io_wq_work_end ] Ctypes.structure typ)
+  end
+
+  module Sched_switch = struct
+    let t = structure "sched_switch"
+    let ( -: ) ty label = field t label ty
+    let prev_pid = int -: "prev_pid"
+    let prev_tid = int -: "prev_tid"
+    let prev_state = long -: "prev_state"
+    let next_pid = int -: "next_pid"
+    let next_tid = int -: "next_tid"
+    let _ = seal (t : [ `Sched_switch ] Ctypes.structure typ)
+  end
+
+  module Sched_wakeup = struct
+    let t = structure "sched_wakeup"
+    let ( -: ) ty label = field t label ty
+    let pid = int -: "pid"
+    let tid = int -: "tid"
+    let target_cpu = int -: "target_cpu"
+    let _ = seal (t : [ `Sched_wakeup ] Ctypes.structure typ)
+  end
+
+  module Block_rq = struct
+    let t = structure "block_rq"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let req = ptr void -: "req"
+    let rq = ptr void -: "rq"
+    let sector = ullong -: "sector"
+    let nr_bytes = uint -: "nr_bytes"
+    let error = int -: "error"
+    let pid = int -: "pid"
+    let _ = seal (t : [ `Block_rq ] Ctypes.structure typ)
+  end
+
+  module Lost_events = struct
+    let t = structure "lost_events"
+    let ( -: ) ty label = field t label ty
+    let count = ullong -: "count"
+    let since = ullong -: "since"
+    let _ = seal (t : [ `Lost_events ] Ctypes.structure typ)
+  end
+
+  module Slow_step = struct
+    let t = structure "slow_step"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let req = ptr void -: "req"
+    let step = enum_tracepoint_t -: "step"
+    let _ = seal (t : [ `Slow_step ] Ctypes.structure typ)
+  end
+
+  module Ring_occupancy = struct
+    let t = structure "ring_occupancy"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let sq_head = uint -: "sq_head"
+    let sq_tail = uint -: "sq_tail"
+    let cq_head = uint -: "cq_head"
+    let cq_tail = uint -: "cq_tail"
+    let sq_entries = uint -: "sq_entries"
+    let cq_entries = uint -: "cq_entries"
+    let _ = seal (t : [ `Ring_occupancy ] Ctypes.structure typ)
+  end
+
+  module Page_cache_stats = struct
+    let t = structure "page_cache_stats"
+    let ( -: ) ty label = field t label ty
+    let ctx = ptr void -: "ctx"
+    let req = ptr void -: "req"
+    let accessed = ullong -: "accessed"
+    let added = ullong -: "added"
+    let _ = seal (t : [ `Page_cache_stats ] Ctypes.structure typ)
+  end
+
+  module Sys_enter_io_uring_enter = struct
+    let t = structure "sys_enter_io_uring_enter"
+    let ( -: ) ty label = field t label ty
+    let fd = uint -: "fd"
+    let to_submit = uint -: "to_submit"
+    let min_complete = uint -: "min_complete"
+    let flags = uint -: "flags"
+    let _ = seal (t : [ `Sys_enter_io_uring_enter ] Ctypes.structure typ)
+
+    module Flags = struct
+      let c label = constant ("IORING_ENTER_" ^ label) int64_t
+
+      let getevents = c "GETEVENTS"
+      and sq_wakeup = c "SQ_WAKEUP"
+      and sq_wait = c "SQ_WAIT"
+      and ext_arg = c "EXT_ARG"
+      and registered_ring = c "REGISTERED_RING"
+    end
+  end
+
+  module Sys_exit_io_uring_enter = struct
+    let t = structure "sys_exit_io_uring_enter"
+    let ( -: ) ty label = field t label ty
+    let ret = long -: "ret"
+    let _ = seal (t : [ `Sys_exit_io_uring_enter ] Ctypes.structure typ)
+  end
+
   module Event = struct
     let t = structure "event"
     let ( -: ) ty label = field t label ty
@@ -292,33 +484,6 @@ module Bindings (T : Cstubs_structs.TYPE) = struct
     let pid = int -: "pid"
     let tid = int -: "tid"
     let ts = uint64_t -: "ts"
-    let comm = array Defines.task_comm_len char -: "comm"
-
-    (* When using stub gen interface, we can just define the union type
-       directly since it uses offsets to calculate the position of the
-       union members. See:
-       https://github.com/yallop/ocaml-ctypes/issues/593 *)
-    let io_uring_create = Create.t -: "io_uring_create"
-    let io_uring_register = Register.t -: "io_uring_register"
-    let io_uring_file_get = File_get.t -: "io_uring_file_get"
-    let io_uring_submit_sqe = Submit_sqe.t -: "io_uring_submit_sqe"
-
-    let io_uring_queue_async_work =
-      Queue_async_work.t -: "io_uring_queue_async_work"
-
-    let io_uring_poll_arm = Poll_arm.t -: "io_uring_poll_arm"
-    let io_uring_task_add = Task_add.t -: "io_uring_task_add"
-    let io_uring_task_work_run = Task_work_run.t -: "io_uring_task_work_run"
-    let io_uring_short_write = Short_write.t -: "io_uring_short_write"
-    let io_uring_local_work_run = Local_work_run.t -: "io_uring_local_work_run"
-    let io_uring_defer = Defer.t -: "io_uring_defer"
-    let io_uring_link = Link.t -: "io_uring_link"
-    let io_uring_fail_link = Fail_link.t -: "io_uring_fail_link"
-    let io_uring_cqring_wait = Cqring_wait.t -: "io_uring_cqring_wait"
-    let io_uring_req_failed = Req_failed.t -: "io_uring_req_failed"
-    let io_uring_cqe_overflow = Cqe_overflow.t -: "io_uring_cqe_overflow"
-    let io_uring_complete = Complete.t -: "io_uring_complete"
-    let io_init_new_worker = Io_init_new_worker.t -: "io_init_new_worker"
     let _ = seal (t : [ `Event ] Ctypes.structure typ)
   end
 end
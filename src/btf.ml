@@ -0,0 +1,39 @@
+(* Minimal reader for the kernel's own BTF, used to pick between
+   program variants before attaching them. Type names all live in the
+   string section, so looking a name up there is enough to tell
+   whether the running kernel knows about a type *)
+
+let vmlinux = "/sys/kernel/btf/vmlinux"
+let magic = 0xeb9f
+
+let read_file path = In_channel.with_open_bin path In_channel.input_all
+
+(* struct btf_header: magic (u16), version (u8), flags (u8), hdr_len,
+   type_off, type_len, str_off, str_len (u32). Offsets are relative to
+   the end of the header *)
+let string_section btf =
+  if String.get_uint16_le btf 0 <> magic then
+    failwith "Unsupported BTF, expected little-endian"
+  else
+    let u32 off = Int32.to_int (String.get_int32_le btf off) in
+    let hdr_len = u32 4 in
+    String.sub btf (hdr_len + u32 16) (u32 20)
+
+let strings = lazy (string_section (read_file vmlinux))
+
+let has_name strings name =
+  let name = name ^ "\x00" in
+  let n = String.length name in
+  (* Names are NUL-separated, only match at the start of one *)
+  let rec loop i =
+    match String.index_from_opt strings i '\x00' with
+    | None -> false
+    | Some j ->
+        (j + 1 - i = n && String.sub strings i n = name) || loop (j + 1)
+  in
+  loop 0
+
+let has_type name = has_name (Lazy.force strings) name
+
+(* Functions are BTF_KIND_FUNC entries, named in the same section *)
+let has_function = has_type
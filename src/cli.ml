@@ -0,0 +1,50 @@
+open Cmdliner
+
+(* Argument converters of the command line *)
+
+let ratio =
+  let parse s =
+    match String.split_on_char '/' s with
+    | [ num; den ] -> (
+        match (int_of_string_opt num, int_of_string_opt den) with
+        | Some num, Some den when num > 0 && den >= num -> Ok (num, den)
+        | _ -> Error (`Msg "expected a ratio N/D with 0 < N <= D"))
+    | _ -> Error (`Msg "expected a ratio N/D, e.g. 1/1000")
+  in
+  let print ppf (num, den) = Format.fprintf ppf "%d/%d" num den in
+  Arg.conv (parse, print)
+
+let positive =
+  let parse s =
+    match int_of_string_opt s with
+    | Some n when n > 0 -> Ok n
+    | _ -> Error (`Msg "expected a positive integer")
+  in
+  Arg.conv (parse, Format.pp_print_int)
+
+let bounded ~min ~max =
+  let parse s =
+    match int_of_string_opt s with
+    | Some n when n >= min && n <= max -> Ok n
+    | _ -> Error (`Msg (Printf.sprintf "expected %d to %d" min max))
+  in
+  Arg.conv (parse, Format.pp_print_int)
+
+let duration =
+  let units =
+    [ ("ns", 1); ("us", 1_000); ("ms", 1_000_000); ("s", 1_000_000_000) ]
+  in
+  let parse s =
+    let split (suffix, scale) =
+      if String.ends_with ~suffix s then
+        let n = String.sub s 0 (String.length s - String.length suffix) in
+        Option.map (fun n -> n * scale) (int_of_string_opt n)
+      else None
+    in
+    (* "ms" and "us" have to be tried before "s" *)
+    match List.find_map split units with
+    | Some ns when ns > 0 -> Ok ns
+    | _ -> Error (`Msg "expected a positive duration, e.g. 500us or 5ms")
+  in
+  let print ppf ns = Format.fprintf ppf "%dns" ns in
+  Arg.conv (parse, print)
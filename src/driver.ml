@@ -8,69 +8,476 @@ type poll_behaviour = Poll of int | Busywait
 
 exception Exit of int
 
+(* Config slots in the "globals" map *)
 let pid_idx = 0
-let total_idx = 1
-let lost_idx = 2
-let skipped_idx = 3
-let unrelated_idx = 4
-let sampling_idx = 5
-let user_idx = 6
-
-let init sampling obj =
-  if sampling then
-    let map = bpf_object_find_map_by_name obj "globals" in
-    bpf_map_update_elem map ~key_ty:Ctypes.int ~val_ty:Ctypes.long sampling_idx
-      (Signed.Long.of_int 1)
-
-let load_run ~sampling ~poll_behaviour ~bpf_object_path ~bpf_program_names
-    ~(writer : W.t) callback =
-  let before_link = init sampling in
-  with_bpf_object_open_load_link ~before_link ~obj_path:bpf_object_path
-    ~program_names:bpf_program_names (fun obj _links ->
-      (* Set signal handlers *)
-      let cont = ref true in
-      let sig_handler = Sys.Signal_handle (fun _ -> cont := false) in
+let sample_num_idx = 1
+let cgroup_idx = 2
+let comm_idx = 3
+let sample_den_idx = 4
+let adaptive_idx = 5
+let hist_idx = 6
+let wakeup_idx = 7
+let shards_idx = 8
+let stacks_idx = 9
+let slow_idx = 10
+let occupancy_idx = 11
+let page_cache_idx = 12
+let block_idx = 13
+let sched_idx = 14
+
+(* Slots set while their category is on, for work done outside the
+   category's own probes *)
+let category_idx =
+  [
+    ("page_cache", page_cache_idx);
+    ("block", block_idx);
+    ("sched", sched_idx);
+  ]
+
+(* Keep [num] out of every [den] requests. In adaptive mode the kernel
+   further divides this rate while the ring buffer is under pressure *)
+type sampling = { num : int; den : int; adaptive : bool }
+
+(* Restrict tracing to a process, cgroup (v2 path) or command name *)
+type target = { pid : int option; cgroup : string option; comm : string option }
+
+(* Per-CPU slots in the "counters" map *)
+let total_idx = 0
+let lost_idx = 1
+let skipped_idx = 2
+let unrelated_idx = 3
+let user_idx = 4
+let peak_idx = 5
+let stack_fail_idx = 6
+
+type counters = {
+  total : int64;
+  lost : int64;
+  skipped : int64;
+  unrelated : int64;
+  user : int64;
+  peak : int64;
+  stack_failures : int64;
+}
+
+let read_counters obj =
+  let map = bpf_object_find_map_by_name obj "counters" in
+  let sum = Maps.percpu_sum_long map in
+  {
+    total = sum total_idx;
+    lost = sum lost_idx;
+    skipped = sum skipped_idx;
+    unrelated = sum unrelated_idx;
+    user = sum user_idx;
+    peak = Maps.percpu_max_long map peak_idx;
+    stack_failures = sum stack_fail_idx;
+  }
+
+(* Matches the size of "rb" in uring.bpf.c *)
+let default_buffer_size = 256 * 4096
+
+let sysconf = Foreign.foreign "sysconf" Ctypes.(int @-> returning long)
+let sc_pagesize = 30
+
+(* Pages are 16 or 64 KiB on some arm64 and powerpc kernels *)
+let page_size = Signed.Long.to_int (sysconf sc_pagesize)
+
+(* Ring buffer sizes must be a power of 2 multiple of the page size *)
+let round_buffer_size size =
+  let rec loop n = if n >= size then n else loop (n * 2) in
+  loop page_size
+
+let set_buffer_size obj size name =
+  match F.bpf_object__find_map_by_name obj name with
+  | None -> failwith "Couldn't find ring buffer map"
+  | Some map ->
+      if F.bpf_map__set_max_entries map (Unsigned.UInt32.of_int size) <> 0 then
+        failwith "Couldn't resize ring buffer"
+
+(* Only the ring buffers in use get the requested size, the others are
+   shrunk to the minimum of one page *)
+let set_buffer_sizes obj size ~shards =
+  let used = Option.value ~default:0 shards in
+  set_buffer_size obj (if used = 0 then size else page_size) "rb";
+  for i = 0 to Shards.max_shards - 1 do
+    set_buffer_size obj
+      (if i < used then size else page_size)
+      (Printf.sprintf "rb_%d" i)
+  done
+
+let print_peak_fill peak buffer_size =
+  Printf.printf "Ring buffer peak fill %Ld of %d bytes (%.1f%%)\n" peak
+    buffer_size
+    (Int64.to_float peak *. 100. /. float_of_int buffer_size)
+
+let print_counters oc c =
+  Printf.fprintf oc
+    "Kernel-space recorded %Ld total events, %Ld lost events, %Ld skipped \
+     events, %Ld unrelated events, sent to user %Ld\n%!"
+    c.total c.lost c.skipped c.unrelated c.user;
+  if c.stack_failures > 0L then
+    Printf.fprintf oc "%Ld sampled stacks couldn't be captured\n%!"
+      c.stack_failures
+
+(* Value of a tracepoint_t in C, as used to index per-type maps *)
+let tracepoint_index ty = List.assoc ty B.C.tracepoint_indices
+
+(* Where the lost events were, per record type and per CPU *)
+let print_losses oc obj =
+  let open Ctypes in
+  let by_type = bpf_object_find_map_by_name obj "lost_by_type" in
+  Printf.fprintf oc "Lost events per type:\n";
+  List.iter
+    (fun (ty, name) ->
+      let lost = Maps.percpu_sum_long by_type (tracepoint_index ty) in
+      if lost > 0L then Printf.fprintf oc "  %-28s %Ld\n" name lost)
+    B.C.tracepoints;
+  Printf.fprintf oc "Lost events per CPU:\n";
+  let counters = bpf_object_find_map_by_name obj "counters" in
+  Maps.percpu_lookup ~key_ty:int ~val_ty:long counters lost_idx
+  |> List.iteri (fun cpu lost ->
+         let lost = Signed.Long.to_int64 lost in
+         if lost > 0L then Printf.fprintf oc "  cpu%-25d %Ld\n" cpu lost)
+
+let set_global obj idx v =
+  let map = bpf_object_find_map_by_name obj "globals" in
+  bpf_map_update_elem map ~key_ty:Ctypes.int ~val_ty:Ctypes.long idx
+    (Signed.Long.of_int v)
+
+let set_comm_filter obj comm =
+  let open Ctypes in
+  let len = B.C.Defines.task_comm_len in
+  let arr = CArray.make char ~initial:'\x00' len in
+  (* The kernel truncates comm to TASK_COMM_LEN - 1 characters *)
+  String.iteri (fun i c -> if i < len - 1 then CArray.set arr i c) comm;
+  let map = bpf_object_find_map_by_name obj "comm_filter" in
+  bpf_map_update_elem map ~key_ty:int ~val_ty:(array len char) 0 arr;
+  set_global obj comm_idx 1
+
+let set_sampling obj { num; den; adaptive } =
+  set_global obj sample_num_idx num;
+  set_global obj sample_den_idx den;
+  if adaptive then set_global obj adaptive_idx 1
+
+(* Largest rate divisor the adaptive sampler is at on any CPU *)
+let adaptive_shift obj =
+  let open Ctypes in
+  let map = bpf_object_find_map_by_name obj "sample_states" in
+  let shift s = getf s B.C.Sample_state.shift |> Unsigned.UInt.to_int in
+  Maps.percpu_lookup ~key_ty:int ~val_ty:B.C.Sample_state.t map 0
+  |> List.fold_left (fun acc s -> max acc (shift s)) 0
+
+(* Frames of a sampled user stack, innermost first. Stacks are deleted
+   once read to free their bucket. Submissions from the same path share
+   the id of an identical stack, records read after the delete get the
+   frames read last for their id *)
+let read_stack obj =
+  let open Ctypes in
+  let map = bpf_object_find_map_by_name obj "stacks" in
+  let frames = array B.C.Defines.max_stack_depth uint64_t in
+  let last = Hashtbl.create 64 in
+  fun id ->
+    let key = Unsigned.UInt32.of_int id in
+    match Maps.lookup ~key_ty:uint32_t ~val_ty:frames map key with
+    | None -> Option.value ~default:[] (Hashtbl.find_opt last id)
+    | Some frames ->
+        Maps.delete ~key_ty:uint32_t map key;
+        let frames =
+          CArray.to_list frames |> List.map Unsigned.UInt64.to_int64
+        in
+        Hashtbl.replace last id frames;
+        frames
+
+let init ~sampling ~target ~histogram ~slow ~occupancy ~batch ~shards ~stacks
+    obj =
+  Option.iter (set_sampling obj) sampling;
+  Option.iter (set_global obj occupancy_idx) occupancy;
+  Option.iter (set_global obj slow_idx) slow;
+  Option.iter (set_global obj stacks_idx) stacks;
+  Option.iter (set_global obj wakeup_idx) batch;
+  Option.iter (set_global obj shards_idx) shards;
+  if Option.is_some histogram then set_global obj hist_idx 1;
+  Option.iter (set_global obj pid_idx) target.pid;
+  (* On cgroup v2 the cgroup id is the inode number of its directory *)
+  Option.iter
+    (fun path -> set_global obj cgroup_idx (Unix.stat path).Unix.st_ino)
+    target.cgroup;
+  Option.iter (set_comm_filter obj) target.comm
+
+(* Returns a function that runs [f] when called at least [interval]
+   seconds after its last run *)
+let every interval f =
+  match interval with
+  | None -> fun () -> ()
+  | Some interval ->
+      let last = ref (Unix.gettimeofday ()) in
+      fun () ->
+        let now = Unix.gettimeofday () in
+        if now -. !last >= interval then (
+          last := now;
+          f ())
+
+(* Attached programs by name and the event categories switched on.
+   Programs that aren't attached cost nothing, so categories can be
+   switched on and off while tracing *)
+type probes = {
+  obj : bpf_object;
+  links : (string, bpf_link) Hashtbl.t;
+  mutable categories : string list;
+}
+
+(* Programs can be missing their attach point on the running kernel,
+   e.g. io-wq functions that got inlined. The rest of their category
+   still works, so only warn *)
+let attach probes name =
+  let name = Programs.variant name in
+  if not (Hashtbl.mem probes.links name) then
+    let prog = bpf_object_find_program_by_name probes.obj name in
+    if not (Programs.loaded prog) then
+      Printf.eprintf "Warning: %s isn't available on this kernel\n%!" name
+    else
+      match bpf_program_attach prog with
+      | link -> Hashtbl.replace probes.links name link
+      | exception Failure msg ->
+          Printf.eprintf "Warning: couldn't attach %s: %s\n%!" name msg
+
+let detach probes name =
+  let name = Programs.variant name in
+  Option.iter
+    (fun link ->
+      bpf_link_destroy link;
+      Hashtbl.remove probes.links name)
+    (Hashtbl.find_opt probes.links name)
+
+let enable probes category =
+  if not (List.mem category probes.categories) then (
+    probes.categories <- category :: probes.categories;
+    Option.iter
+      (fun idx -> set_global probes.obj idx 1)
+      (List.assoc_opt category category_idx);
+    List.iter (attach probes) (List.assoc category Site.categories))
+
+(* Categories can share programs, those stay attached as long as one of
+   their categories is on *)
+let disable probes category =
+  if List.mem category probes.categories then (
+    probes.categories <- List.filter (( <> ) category) probes.categories;
+    let still_used = Site.category_program_names probes.categories in
+    List.assoc category Site.categories
+    |> List.filter (fun name -> not (List.mem name still_used))
+    |> List.iter (detach probes);
+    Option.iter
+      (fun idx -> set_global probes.obj idx 0)
+      (List.assoc_opt category category_idx))
+
+(* Same as Libbpf.with_bpf_object_open_load_link, with an extra hook
+   before loading for settings that are fixed once maps are created.
+   [categories] are switched on after [program_names] are attached *)
+let with_bpf_object ~obj_path ~program_names ~categories ~before_load
+    ~before_link fn =
+  let obj = bpf_object_open obj_path in
+  Fun.protect
+    ~finally:(fun () -> bpf_object_close obj)
+    (fun () ->
+      before_load obj;
+      bpf_object_load obj;
+      before_link obj;
+      let probes = { obj; links = Hashtbl.create 32; categories = [] } in
+      Fun.protect
+        ~finally:(fun () ->
+          Hashtbl.iter (fun _ link -> bpf_link_destroy link) probes.links)
+        (fun () ->
+          List.iter (attach probes) program_names;
+          List.iter (enable probes) categories;
+          fn probes))
+
+(* Lines like "+worker" or "-syscalls" on stdin attach or detach an
+   event category while tracing. Histogram and slow mode only work with
+   their own probes, [toggles] is false for them *)
+let control ~toggles probes =
+  let apply line =
+    let line = String.trim line in
+    let n = String.length line in
+    let toggle =
+      if n < 2 || not toggles then None
+      else
+        let category = String.sub line 1 (n - 1) in
+        match (line.[0], List.mem_assoc category Site.categories) with
+        | '+', true -> Some (enable, category)
+        | '-', true -> Some (disable, category)
+        | _ -> None
+    in
+    match toggle with
+    | Some (toggle, category) ->
+        toggle probes category;
+        Printf.printf "%s\n%!" line
+    | None when n = 0 -> ()
+    | None when not toggles ->
+        Printf.eprintf
+          "Categories can't be switched with --histogram or --slow\n%!"
+    | None ->
+        Printf.eprintf "Expected +CATEGORY or -CATEGORY, one of %s\n%!"
+          (String.concat ", " (List.map fst Site.categories))
+  in
+  let stdin_open = ref true in
+  let pending = Buffer.create 64 in
+  let chunk = Bytes.create 256 in
+  fun () ->
+    while
+      !stdin_open
+      &&
+      match Unix.select [ Unix.stdin ] [] [] 0. with
+      | [], _, _ -> false
+      | _ -> true
+    do
+      match Unix.read Unix.stdin chunk 0 (Bytes.length chunk) with
+      | 0 -> stdin_open := false
+      | n -> Buffer.add_subbytes pending chunk 0 n
+    done;
+    (* Only complete lines, the rest waits for the next tick *)
+    let input = Buffer.contents pending in
+    match String.rindex_opt input '\n' with
+    | None -> ()
+    | Some i ->
+        Buffer.clear pending;
+        Buffer.add_string pending
+          (String.sub input (i + 1) (String.length input - i - 1));
+        String.sub input 0 i |> String.split_on_char '\n' |> List.iter apply
+
+(* Single ring buffer shared by all CPUs, consumed in place *)
+let consume_single obj ~cont ~batch ~poll_behaviour ~tick callback_w_ctx =
+  let map = bpf_object_find_map_by_name obj "rb" in
+  Libbpf_maps.RingBuffer.init map ~callback:callback_w_ctx (fun rb ->
+      match poll_behaviour with
+      | Poll timeout ->
+          while Atomic.get cont do
+            (match Libbpf_maps.RingBuffer.poll rb ~timeout with
+            (* Ctrl-C will cause -EINTR exception *)
+            | e when e = Sys.sigint -> Atomic.set cont false
+            (* Batched events below the wakeup watermark don't
+               wake us up, drain them once the timeout expires *)
+            | 0 when Option.is_some batch ->
+                ignore (Libbpf_maps.RingBuffer.consume rb)
+            | _ -> ());
+            tick ()
+          done
+      | Busywait -> (
+          match Libbpf_maps.RingBuffer.consume rb with
+          | e when e = Sys.sigint -> Atomic.set cont false
+          | _ -> ()))
+
+(* Registers the rings that were set up before tracing started *)
+let snapshot_rings obj =
+  try Iter.run (bpf_object_find_program_by_name obj Site.snapshot_program_name)
+  with Failure msg -> Printf.eprintf "Skipping ring snapshot: %s\n%!" msg
+
+(* Samples the SQ/CQ occupancy of every traced ring each [interval] ms.
+   Returns the function to call on every tick and the one to stop *)
+let occupancy_sampler obj interval =
+  match interval with
+  | None -> ((fun () -> ()), fun () -> ())
+  | Some ms ->
+      let link =
+        Iter.attach
+          ~map:(bpf_object_find_map_by_name obj "rings")
+          (bpf_object_find_program_by_name obj Site.occupancy_program_name)
+      in
+      let period = float_of_int ms /. 1000. in
+      ( every (Some period) (fun () -> Iter.iterate link),
+        fun () -> Iter.destroy link )
+
+let load_run ~sampling ~target ~histogram ~slow ~occupancy ~batch ~buffer_size
+    ~shards ~stacks ~poll_behaviour ~stats_interval ~bpf_object_path
+    ~bpf_program_names ~categories ~toggles ~(writer : W.t) callback =
+  let buffer_size =
+    Option.fold ~none:default_buffer_size ~some:round_buffer_size buffer_size
+  in
+  (* Busywaiting stays on the single ring buffer *)
+  let shards =
+    match (shards, poll_behaviour) with
+    | Some n, Poll _ when n > 1 -> Some n
+    | _ -> None
+  in
+  (* Everything else is left out of loading, so that programs this
+     kernel can't attach don't fail the whole object *)
+  let iterators =
+    Site.snapshot_program_name
+    :: (if Option.is_some occupancy then [ Site.occupancy_program_name ]
+        else [])
+  in
+  (* Any category can be switched on while tracing *)
+  let toggled_program_names =
+    if toggles then Site.category_program_names (List.map fst Site.categories)
+    else []
+  in
+  let loaded =
+    List.map Programs.variant (bpf_program_names @ toggled_program_names)
+    @ iterators
+  in
+  let before_load obj =
+    set_buffer_sizes obj buffer_size ~shards;
+    Programs.select obj loaded
+  in
+  let before_link =
+    init ~sampling ~target ~histogram ~slow ~occupancy ~batch ~shards ~stacks
+  in
+  with_bpf_object ~before_load ~before_link ~obj_path:bpf_object_path
+    ~program_names:bpf_program_names ~categories (fun probes ->
+      let obj = probes.obj in
+      (* Set signal handlers, the flag is shared with the shard domains *)
+      let cont = Atomic.make true in
+      let sig_handler = Sys.Signal_handle (fun _ -> Atomic.set cont false) in
       Sys.(set_signal sigint sig_handler);
       Sys.(set_signal sigterm sig_handler);
 
+      (* Only once the tracepoints are attached, so that no ring falls
+         in between *)
+      snapshot_rings obj;
+      Handler.stack_frames := read_stack obj;
       let callback_w_ctx = callback writer in
-      let map = bpf_object_find_map_by_name obj "rb" in
-      Libbpf_maps.RingBuffer.init map ~callback:callback_w_ctx (fun rb ->
-          (match poll_behaviour with
-          | Poll timeout ->
-              while !cont do
-                match Libbpf_maps.RingBuffer.poll rb ~timeout with
-                (* Ctrl-C will cause -EINTR exception *)
-                | e when e = Sys.sigint -> cont := false
-                | _ -> ()
-              done
-          | Busywait -> (
-              match Libbpf_maps.RingBuffer.consume rb with
-              | e when e = Sys.sigint -> cont := false
-              | _ -> ()));
-
-          let globals = bpf_object_find_map_by_name obj "globals" in
-          let lookup_globals idx =
-            bpf_map_lookup_value ~key_ty:Ctypes.int ~val_ty:Ctypes.long
-              ~val_zero:Signed.Long.zero globals idx
-          in
-          (* Print globals at the end *)
-          let total = lookup_globals 1 in
-          let lost = lookup_globals 2 in
-          let skipped = lookup_globals 3 in
-          let unrelated = lookup_globals 4 in
-          let user = lookup_globals 6 in
-          let str_of_long clong =
-            Ctypes_value_printing.string_of Ctypes.long clong
-          in
-          Printf.printf
-            "\n\
-             Kernel-space recorded %s total events, %s lost events, %s skipped \
-             events, %s unrelated events, sent to user %s\n"
-            (str_of_long total) (str_of_long lost) (str_of_long skipped)
-            (str_of_long unrelated) (str_of_long user)))
-
-let run ~tracefile ~sampling ~poll_behaviour =
+      (* Periodically report the counters and histograms while tracing *)
+      let report_stats =
+        every stats_interval (fun () ->
+            print_counters stderr (read_counters obj))
+      in
+      let report_histogram =
+        every histogram (fun () -> Histogram.print stdout obj)
+      in
+      let control = control ~toggles probes in
+      let sample_occupancy, stop_occupancy = occupancy_sampler obj occupancy in
+      let tick () =
+        report_stats ();
+        report_histogram ();
+        sample_occupancy ();
+        control ()
+      in
+      Fun.protect ~finally:stop_occupancy (fun () ->
+          match (shards, poll_behaviour) with
+          | Some n, Poll timeout ->
+              Shards.consume obj ~shards:n ~cont ~timeout ~tick callback_w_ctx
+          | _ ->
+              consume_single obj ~cont ~batch ~poll_behaviour ~tick
+                callback_w_ctx);
+
+      (* Print counters at the end *)
+      if Option.is_some histogram then Histogram.print stdout obj;
+      print_string "\n";
+      let counters = read_counters obj in
+      print_counters stdout counters;
+      if counters.lost > 0L then print_losses stdout obj;
+      print_peak_fill counters.peak buffer_size;
+      match sampling with
+      | Some { num; den; adaptive = true } ->
+          Printf.printf "Adaptive sampling rate on the busiest CPU: %d/%d\n" num
+            (den lsl adaptive_shift obj)
+      | _ -> ())
+
+let run ~tracefile ~sampling ~target ~histogram ~slow ~occupancy ~batch
+    ~buffer_size ~shards ~events ~sched ~block ~page_cache ~find_user_data
+    ~stacks ~poll_behaviour ~stats_interval =
+  List.iter
+    (fun v -> Hashtbl.replace Handler.watched_user_data v ())
+    find_user_data;
   Eio_linux.run @@ fun env ->
   Eio.Switch.run (fun sw ->
       let output_file = Eio.Path.( / ) (Eio.Stdenv.cwd env) tracefile in
@@ -80,8 +487,26 @@ let run ~tracefile ~sampling ~poll_behaviour =
       Eio.Buf_write.with_flow out (fun w ->
           let writer = W.make (W.FW.of_writer w) in
           try
-            load_run ~sampling ~poll_behaviour
-              ~bpf_object_path:Site.bpf_object_path
-              ~bpf_program_names:Site.bpf_program_names ~writer
-              Handler.handle_event
+            let normal = Option.is_none histogram && Option.is_none slow in
+            let bpf_program_names =
+              if Option.is_some histogram then Site.histogram_program_names
+              else if Option.is_some slow then Site.slow_program_names
+              else Site.ring_program_names
+            in
+            let categories =
+              if not normal then []
+              else
+                List.concat
+                  [
+                    Option.value ~default:Site.default_categories events;
+                    (if sched then [ "sched" ] else []);
+                    (if block then [ "block" ] else []);
+                    (if page_cache then [ "page_cache" ] else []);
+                  ]
+                |> List.sort_uniq compare
+            in
+            load_run ~sampling ~target ~histogram ~slow ~occupancy ~batch
+              ~buffer_size ~shards ~stacks ~poll_behaviour ~stats_interval
+              ~bpf_object_path:Site.bpf_object_path ~bpf_program_names
+              ~categories ~toggles:normal ~writer Handler.handle_event
           with Exit i -> Printf.eprintf "exit %d\n" i))
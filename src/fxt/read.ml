@@ -0,0 +1,135 @@
+type kind =
+  [ `Instant
+  | `Counter
+  | `Duration_begin
+  | `Duration_end
+  | `Async_begin
+  | `Async_instant
+  | `Async_end
+  | `Flow_begin
+  | `Flow_step
+  | `Flow_end ]
+
+type event = {
+  kind : kind;
+  name : string;
+  category : string;
+  thread : Write.thread;
+  ts : int64;
+  args : Write.args;
+  correlation_id : int64 option;
+}
+
+type t = { strings : string array; threads : Write.thread array }
+
+(* A record without its header word, read a word at a time *)
+type body = { s : string; mutable pos : int }
+
+let bits x ~off ~len =
+  let mask = Int64.(sub (shift_left 1L len) 1L) in
+  Int64.(to_int (logand (shift_right_logical x off) mask))
+
+let next b =
+  let x = String.get_int64_le b.s (8 * b.pos) in
+  b.pos <- b.pos + 1;
+  x
+
+let string_ref t b = function
+  | 0 -> ""
+  | r when r land 0x8000 = 0 -> t.strings.(r)
+  | r ->
+      let len = r land 0x7fff in
+      let s = String.sub b.s (8 * b.pos) len in
+      b.pos <- b.pos + ((len + 7) / 8);
+      s
+
+let arg t b =
+  let header = next b in
+  let start = b.pos in
+  let name = string_ref t b (bits header ~off:16 ~len:16) in
+  let value =
+    match bits header ~off:0 ~len:4 with
+    | 3 -> `Int64 (next b)
+    | 6 -> `String (string_ref t b (bits header ~off:32 ~len:16))
+    | 7 -> `Pointer (next b)
+    | 8 -> `Koid (next b)
+    | _ -> `Unit
+  in
+  (* Skips over argument types we don't decode *)
+  b.pos <- start + bits header ~off:4 ~len:12 - 1;
+  (name, value)
+
+let kind = function
+  | 0 -> Some `Instant
+  | 1 -> Some `Counter
+  | 2 -> Some `Duration_begin
+  | 3 -> Some `Duration_end
+  | 5 -> Some `Async_begin
+  | 6 -> Some `Async_instant
+  | 7 -> Some `Async_end
+  | 8 -> Some `Flow_begin
+  | 9 -> Some `Flow_step
+  | 10 -> Some `Flow_end
+  | _ -> None
+
+let event t f header b =
+  match kind (bits header ~off:16 ~len:4) with
+  | None -> ()
+  | Some kind ->
+      let ts = next b in
+      let thread =
+        match bits header ~off:24 ~len:8 with
+        | 0 ->
+            let pid = next b in
+            Write.{ pid; tid = next b }
+        | r -> t.threads.(r)
+      in
+      let category = string_ref t b (bits header ~off:32 ~len:16) in
+      let name = string_ref t b (bits header ~off:48 ~len:16) in
+      let rec args n =
+        if n = 0 then []
+        else
+          let a = arg t b in
+          a :: args (n - 1)
+      in
+      let args = args (bits header ~off:20 ~len:4) in
+      let correlation_id =
+        match kind with
+        | `Counter | `Async_begin | `Async_instant | `Async_end | `Flow_begin
+        | `Flow_step | `Flow_end ->
+            Some (next b)
+        | `Instant | `Duration_begin | `Duration_end -> None
+      in
+      f { kind; name; category; thread; ts; args; correlation_id }
+
+let record t f header b =
+  match bits header ~off:0 ~len:4 with
+  | 2 ->
+      let len = bits header ~off:32 ~len:15 in
+      t.strings.(bits header ~off:16 ~len:15) <- String.sub b.s 0 len
+  | 3 ->
+      let pid = next b in
+      t.threads.(bits header ~off:16 ~len:8) <- Write.{ pid; tid = next b }
+  | 4 -> event t f header b
+  | _ -> ()
+
+let iter f ic =
+  let t =
+    {
+      strings = Array.make 0x8000 "";
+      threads = Array.make 0x100 Write.{ pid = 0L; tid = 0L };
+    }
+  in
+  let rec loop () =
+    match
+      let header = String.get_int64_le (really_input_string ic 8) 0 in
+      let words = bits header ~off:4 ~len:12 in
+      if words = 0 then failwith "Unsupported large record";
+      (header, really_input_string ic (8 * (words - 1)))
+    with
+    | exception End_of_file -> ()
+    | header, s ->
+        record t f header { s; pos = 0 };
+        loop ()
+  in
+  loop ()
@@ -0,0 +1,28 @@
+(** Read back the event records of files written by {!Write}. Strings
+    and threads are resolved, other records are skipped. *)
+
+type kind =
+  [ `Instant
+  | `Counter
+  | `Duration_begin
+  | `Duration_end
+  | `Async_begin
+  | `Async_instant
+  | `Async_end
+  | `Flow_begin
+  | `Flow_step
+  | `Flow_end ]
+
+type event = {
+  kind : kind;
+  name : string;
+  category : string;
+  thread : Write.thread;
+  ts : int64;
+  args : Write.args;
+  correlation_id : int64 option;
+}
+
+val iter : (event -> unit) -> in_channel -> unit
+(** Calls the function on every event in file order. A truncated last
+    record, e.g. from an interrupted trace, ends the file. *)
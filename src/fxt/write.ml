@@ -216,8 +216,12 @@ let event ~ty ?(args = []) ?correlation_id t ~name ~thread ~category ~ts =
   match correlation_id with None -> () | Some i64 -> word t i64
 
 let instant_event = event ~ty:0 ?correlation_id:None
+let counter ?args t ~id = event ?args t ~ty:1 ~correlation_id:id
 let duration_begin = event ~ty:2 ?correlation_id:None
 let duration_end = event ~ty:3 ?correlation_id:None
+let async_begin ?args t ~correlation_id = event ?args t ~ty:5 ~correlation_id
+let async_instant ?args t ~correlation_id = event ?args t ~ty:6 ~correlation_id
+let async_end ?args t ~correlation_id = event ?args t ~ty:7 ~correlation_id
 let flow_begin ?args t ~correlation_id = event ?args t ~ty:8 ~correlation_id
 let flow_step ?args t ~correlation_id = event ?args t ~ty:9 ~correlation_id
 let flow_end ?args t ~correlation_id = event ?args t ~ty:10 ~correlation_id
@@ -23,6 +23,16 @@ val instant_event :
   ts:int64 ->
   unit
 
+val counter :
+  ?args:args ->
+  t ->
+  id:int64 ->
+  name:string ->
+  thread:thread ->
+  category:string ->
+  ts:int64 ->
+  unit
+
 val duration_begin :
   ?args:args ->
   t ->
@@ -71,6 +81,36 @@ val flow_end :
   ts:int64 ->
   unit
 
+val async_begin :
+  ?args:args ->
+  t ->
+  correlation_id:int64 ->
+  name:string ->
+  thread:thread ->
+  category:string ->
+  ts:int64 ->
+  unit
+
+val async_instant :
+  ?args:args ->
+  t ->
+  correlation_id:int64 ->
+  name:string ->
+  thread:thread ->
+  category:string ->
+  ts:int64 ->
+  unit
+
+val async_end :
+  ?args:args ->
+  t ->
+  correlation_id:int64 ->
+  name:string ->
+  thread:thread ->
+  category:string ->
+  ts:int64 ->
+  unit
+
 val user_object :
   ?args:args -> t -> name:string -> thread:thread -> int64 -> unit
 
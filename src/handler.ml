@@ -8,44 +8,224 @@ let cb = ref 0
 (* Add a view that shows when the complete task is read? *)
 (* How to get ring specific tracks? Segregate by Process and then each thread is a the thread ID? *)
 
+(* user_data values to look out for, every event carrying one of them
+   is reported on stdout while tracing *)
+let watched_user_data : (int64, unit) Hashtbl.t = Hashtbl.create 8
+
+(* Requests seen with a watched user_data by req_ptr, until their last
+   CQE. Records that don't carry user_data are matched on these *)
+let watched_reqs : (int64, int64) Hashtbl.t = Hashtbl.create 8
+
+let print_report ~name ~tid ~ts user_data =
+  Printf.printf "user_data 0x%Lx: %s on tid %Ld at %Ld ns\n%!" user_data name
+    tid ts
+
+let report_user_data ~name ~tid ~ts ~req user_data =
+  if Hashtbl.length watched_user_data > 0 then
+    if Hashtbl.mem watched_user_data user_data then (
+      Hashtbl.replace watched_reqs req user_data;
+      print_report ~name ~tid ~ts user_data)
+    else
+      (* The address was reused by a request nobody watches *)
+      Hashtbl.remove watched_reqs req
+
+let report_req ~name ~tid ~ts req =
+  Option.iter (print_report ~name ~tid ~ts) (Hashtbl.find_opt watched_reqs req)
+
+(* Threads' comm, the kernel only sends it along with the first event
+   of each thread *)
+let comms : (int64, string) Hashtbl.t = Hashtbl.create 64
+
+let comm_of tid = Option.value ~default:"" (Hashtbl.find_opt comms tid)
+
+(* Frames of a sampled stack id, set by the driver once the maps exist *)
+let stack_frames : (int -> int64 list) ref = ref (fun _ -> [])
+
+let create_args (t : B.io_uring_create) =
+  [
+    ("file descriptor", `Int64 (Int64.of_int t.fd));
+    ("ring_ptr", `String (show_ptr t.ctx_ptr));
+    ("sq_entries", `Int64 (Int64.of_int32 t.sq_entries));
+    ("cq_entries", `Int64 (Int64.of_int32 t.cq_entries));
+    ("flags", `String (B.Setup_flags.show t.flags));
+  ]
+
+(* Page cache activity of requests, sent right before their completion *)
+let page_cache : (int64, B.page_cache_stats) Hashtbl.t = Hashtbl.create 64
+
+let page_cache_args correlation_id =
+  match Hashtbl.find_opt page_cache correlation_id with
+  | None -> []
+  | Some (s : B.page_cache_stats) ->
+      Hashtbl.remove page_cache correlation_id;
+      [
+        ("page_cache", `String (if s.added = 0L then "hit" else "miss"));
+        ("pages_accessed", `Int64 s.accessed);
+        ("readahead_pages", `Int64 s.added);
+      ]
+
 (* Describe event handler *)
 let handle_event (writer : W.t) _ctx data _size =
   let open Ctypes in
   incr cb;
   let event = !@(from_voidp B.C.Event.t data) in
   let ev = B.unload_event event in
-  let comm = ev.comm in
   let pid = Int64.of_int ev.pid in
   let tid = Int64.of_int ev.tid in
   let ts = Unsigned.UInt64.to_int64 ev.ts in
   (match ev.ty with
-  | ( B.SYS_ENTER_IO_URING_ENTER | B.SYS_ENTER_IO_URING_REGISTER
-    | B.SYS_ENTER_IO_URING_SETUP ) as ev ->
+  | B.TASK_COMM ->
+      let comm = B.payload B.C.Task_comm.t data |> B.unload_task_comm in
+      Hashtbl.replace comms tid comm
+  | B.SLOW_STEP ->
+      (* Held back in the kernel until the request turned out slow,
+         only the type of the event is known *)
+      let t = B.payload B.C.Slow_step.t data |> B.unload_slow_step in
+      let name = String.lowercase_ascii (B.show_tracepoint_t t.step) in
+      let correlation_id =
+        t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
+      in
+      report_req ~name ~tid ~ts correlation_id;
+      W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name ~ts ~correlation_id
+        ~args:[ ("req_ptr", `String (show_ptr t.req_ptr)) ]
+  | B.PAGE_CACHE ->
+      let t =
+        B.payload B.C.Page_cache_stats.t data |> B.unload_page_cache_stats
+      in
+      let correlation_id =
+        t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
+      in
+      Hashtbl.replace page_cache correlation_id t;
+      W.page_cache_ev writer ~ring_ctx:t.ctx_ptr ~pid ~ts ~hit:(t.added = 0L)
+  | B.RING_OCCUPANCY ->
+      let t =
+        B.payload B.C.Ring_occupancy.t data |> B.unload_ring_occupancy
+      in
+      W.occupancy writer ~ring_ctx:t.ctx_ptr ~pid ~ts ~sq:t.sq_depth
+        ~cq:t.cq_depth
+  | B.LOST_EVENTS ->
+      (* Flows around this point on this CPU may be incomplete *)
+      let t = B.payload B.C.Lost_events.t data |> B.unload_lost_events in
+      W.instant_event writer ~name:"events lost" ~pid ~tid ~ts
+        ~args:[ ("count", `Int64 t.count); ("since", `Int64 t.since) ]
+  | B.SYS_ENTER_IO_URING_ENTER as ev ->
+      let t =
+        B.payload B.C.Sys_enter_io_uring_enter.t data
+        |> B.unload_sys_enter_io_uring_enter
+      in
+      W.syscall_begin writer ~name:(B.show_tracepoint_t ev) ~pid ~tid ~ts
+        ~args:
+          [
+            ("fd", `Int64 (Int64.of_int t.fd));
+            ("to_submit", `Int64 (Int64.of_int t.to_submit));
+            ("min_complete", `Int64 (Int64.of_int t.min_complete));
+            ("flags", `String (B.Enter_flags.show t.flags));
+          ]
+  | B.SYS_EXIT_IO_URING_ENTER as ev ->
+      let t =
+        B.payload B.C.Sys_exit_io_uring_enter.t data
+        |> B.unload_sys_exit_io_uring_enter
+      in
+      W.syscall_end writer ~name:(B.show_tracepoint_t ev) ~pid ~tid ~ts
+        ~args:[ ("ret", `Int64 t.ret) ]
+  | (B.SYS_ENTER_IO_URING_REGISTER | B.SYS_ENTER_IO_URING_SETUP) as ev ->
       W.syscall_begin writer ~name:(B.show_tracepoint_t ev) ~pid ~tid ~ts
-  | ( B.SYS_EXIT_IO_URING_ENTER | B.SYS_EXIT_IO_URING_REGISTER
-    | B.SYS_EXIT_IO_URING_SETUP ) as ev ->
+  | (B.SYS_EXIT_IO_URING_REGISTER | B.SYS_EXIT_IO_URING_SETUP) as ev ->
       W.syscall_end writer ~name:(B.show_tracepoint_t ev) ~pid ~tid ~ts
   | B.KPROBE_IO_INIT_NEW_WORKER as ev ->
-      let t = getf event B.C.Event.io_init_new_worker in
+      let t = B.payload B.C.Io_init_new_worker.t data in
       let worker_tid = getf t B.C.Io_init_new_worker.io_worker_tid in
       W.create_worker_ev writer ~name:(B.show_tracepoint_t ev) ~pid ~tid
-        ~worker_tid ~comm ~ts
-  (* Tracepoints *)
-  | B.IO_URING_CREATE ->
-      let t = getf event B.C.Event.io_uring_create |> B.unload_create in
-      let flag_list_str = t.flags |> B.Setup_flags.show in
-      W.create_ring_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid
-        ~name:"io_uring_create" ~comm ~ts
+        ~worker_tid ~comm:(comm_of tid) ~ts
+  | B.FENTRY_IO_WQ_SUBMIT_WORK ->
+      let t =
+        B.payload B.C.Io_wq_work_begin.t data |> B.unload_io_wq_work_begin
+      in
+      let correlation_id =
+        t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
+      in
+      report_req ~name:"io_wq_work_begin" ~tid ~ts correlation_id;
+      W.work_begin writer ~ring_ctx:t.ctx_ptr ~pid ~tid ~name:"io_wq_work" ~ts
+        ~correlation_id
         ~args:
           [
-            ("file descriptor", `Int64 (Int64.of_int t.fd));
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
-            ("sq_entries", `Int64 (Int64.of_int32 t.sq_entries));
-            ("cq_entries", `Int64 (Int64.of_int32 t.cq_entries));
-            ("flags", `String flag_list_str);
+            ("req_ptr", `String (show_ptr t.req_ptr));
+            ("work_ptr", `String (show_ptr t.work_ptr));
+            ("queue_wait_ns", `Int64 t.queue_wait);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
+  | B.FEXIT_IO_WQ_SUBMIT_WORK ->
+      let t = B.payload B.C.Io_wq_work_end.t data |> B.unload_io_wq_work_end in
+      report_req ~name:"io_wq_work_end" ~tid ~ts
+        (t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint);
+      W.work_end writer ~ring_ctx:t.ctx_ptr ~pid ~tid ~name:"io_wq_work" ~ts
+  | B.SCHED_SWITCH ->
+      let t = B.payload B.C.Sched_switch.t data |> B.unload_sched_switch in
+      (* 0x100 is TASK_REPORT_MAX, reported for preempted tasks *)
+      let runnable =
+        t.prev_state = 0L || Int64.logand t.prev_state 0x100L <> 0L
+      in
+      if t.prev_pid <> 0 then
+        W.sched_state writer ~ts
+          ~pid:(Int64.of_int t.prev_pid)
+          ~tid:(Int64.of_int t.prev_tid)
+          (if runnable then "runnable" else "blocked");
+      if t.next_pid <> 0 then
+        W.sched_state writer ~ts
+          ~pid:(Int64.of_int t.next_pid)
+          ~tid:(Int64.of_int t.next_tid)
+          "running"
+  | B.SCHED_WAKEUP ->
+      let t = B.payload B.C.Sched_wakeup.t data |> B.unload_sched_wakeup in
+      W.sched_wakeup writer ~ts ~cpu:t.target_cpu
+        ~pid:(Int64.of_int t.pid)
+        ~tid:(Int64.of_int t.tid)
+  | (B.BLOCK_RQ_INSERT | B.BLOCK_RQ_ISSUE | B.BLOCK_RQ_COMPLETE) as ev ->
+      let t = B.payload B.C.Block_rq.t data |> B.unload_block_rq in
+      let rq = t.rq_ptr |> raw_address_of_ptr |> Int64.of_nativeint in
+      let phase =
+        match ev with
+        | B.BLOCK_RQ_INSERT -> `Insert
+        | B.BLOCK_RQ_ISSUE -> `Issue
+        | _ -> `Complete
+      in
+      report_req
+        ~name:(String.lowercase_ascii (B.show_tracepoint_t ev))
+        ~tid ~ts
+        (t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint);
+      W.block_ev writer ~ring_ctx:t.ctx_ptr ~pid:(Int64.of_int t.pid) ~ts ~rq
+        phase
+        ~args:
+          [
+            ("req_ptr", `String (show_ptr t.req_ptr));
+            ("rq_ptr", `String (show_ptr t.rq_ptr));
+            ("sector", `Int64 t.sector);
+            ("nr_bytes", `Int64 (Int64.of_int t.nr_bytes));
+            ("error", `Int64 (Int64.of_int t.error));
+          ];
+      (* Link the issue into the request's flow when it happens on one
+         of the request's own threads *)
+      if ev = B.BLOCK_RQ_ISSUE && Int64.of_int t.pid = pid then
+        W.flow_ev writer ~ring_ctx:t.ctx_ptr ~pid ~tid ~name:"block_rq_issue"
+          ~ts
+          ~correlation_id:
+            (t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint)
+  (* Tracepoints *)
+  | B.IO_URING_CREATE ->
+      let t = B.payload B.C.Create.t data |> B.unload_create in
+      W.create_ring_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid
+        ~name:"io_uring_create" ~comm:(comm_of tid) ~ts ~args:(create_args t)
+  | B.RING_SNAPSHOT ->
+      (* Ring set up before tracing started *)
+      let { B.ring = t; comm } =
+        B.payload B.C.Ring_snapshot.t data |> B.unload_ring_snapshot
+      in
+      Hashtbl.replace comms tid comm;
+      W.create_ring_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid
+        ~name:"io_uring_snapshot" ~comm ~ts ~args:(create_args t)
   | B.IO_URING_REGISTER ->
-      let t = getf event B.C.Event.io_uring_register |> B.unload_register in
+      let t = B.payload B.C.Register.t data |> B.unload_register in
       W.instant_event writer ~name:"io_uring_register" ~pid ~tid ~ts
         ~args:
           [
@@ -56,120 +236,148 @@ let handle_event (writer : W.t) _ctx data _size =
             ("ret", `Int64 t.ret);
           ]
   | B.IO_URING_SUBMIT_SQE ->
-      let t = getf event B.C.Event.io_uring_submit_sqe |> B.unload_submit_sqe in
+      let t = B.payload B.C.Submit_sqe.t data |> B.unload_submit_sqe in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
       let flag_list_str = t.flags |> B.Sqe_flags.show in
+      let stack =
+        if t.stack_id < 0 then []
+        else
+          let frames = !stack_frames t.stack_id in
+          [ ("stack", `String (Symbolize.stack pid frames)) ]
+      in
+      report_user_data ~name:"io_uring_submit" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.submit_ev writer ~ring_ctx:t.ctx_ptr ~pid ~tid ~name:"io_uring_submit"
         ~ts ~correlation_id
         ~args:
-          [
-            ("ring_ptr", `String (show_ptr t.ctx_ptr));
-            ("req_ptr", `String (show_ptr t.req_ptr));
-            ("op_str", `String t.op_str);
-            ("opcode", `Int64 (Int64.of_int t.opcode));
-            ("flags", `String flag_list_str);
-            ("force_nonblock", `String (Bool.to_string t.force_nonblock));
-            ("sq_thread", `String (Bool.to_string t.sq_thread));
-          ]
+          ([
+             ("ring_ptr", `String (show_ptr t.ctx_ptr));
+             ("req_ptr", `String (show_ptr t.req_ptr));
+             ("user_data", `Pointer t.user_data);
+             ("op_str", `String (B.Opcode.show t.opcode));
+             ("opcode", `Int64 (Int64.of_int t.opcode));
+             ("flags", `String flag_list_str);
+             ("force_nonblock", `String (Bool.to_string t.force_nonblock));
+             ("sq_thread", `String (Bool.to_string t.sq_thread));
+           ]
+          @ stack)
   | B.IO_URING_QUEUE_ASYNC_WORK ->
       let t =
-        getf event B.C.Event.io_uring_queue_async_work
-        |> B.unload_queue_async_work
+        B.payload B.C.Queue_async_work.t data |> B.unload_queue_async_work
       in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_queue_async_work" ~tid ~ts
+        ~req:correlation_id t.user_data;
       W.flow_ev writer ~ring_ctx:t.ctx_ptr ~pid ~tid
         ~name:"io_uring_queue_async_work" ~ts ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("opcode", `Int64 (Int64.of_int t.opcode));
             ("flags", `Int64 (Int64.of_int32 t.flags));
             ("work_ptr", `String (show_ptr t.work_ptr));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_TASK_ADD ->
-      let t = getf event B.C.Event.io_uring_task_add |> B.unload_task_add in
+      let t = B.payload B.C.Task_add.t data |> B.unload_task_add in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_task_add" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_task_add"
         ~ts ~correlation_id
         ~args:
           [
             ("ring_ctx", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("opcode", `Int64 (Int64.of_int t.opcode));
             ("mask", `Int64 (Int64.of_int t.mask));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_POLL_ARM ->
-      let t = getf event B.C.Event.io_uring_poll_arm |> B.unload_poll_arm in
+      let t = B.payload B.C.Poll_arm.t data |> B.unload_poll_arm in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_poll_arm" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_poll_arm"
         ~ts ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("opcode", `Int64 (Int64.of_int t.opcode));
             ("mask", `Int64 (Int64.of_int t.mask));
             ("events", `Int64 (Int64.of_int t.events));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_FILE_GET ->
-      let t = getf event B.C.Event.io_uring_file_get |> B.unload_file_get in
+      let t = B.payload B.C.File_get.t data |> B.unload_file_get in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_file_get" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_file_get"
         ~ts ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("fd", `Int64 (Int64.of_int t.fd));
           ]
   | B.IO_URING_DEFER ->
-      let t = getf event B.C.Event.io_uring_defer |> B.unload_defer in
+      let t = B.payload B.C.Defer.t data |> B.unload_defer in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_defer" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_defer" ~ts
         ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("opcode", `Int64 (Int64.of_int t.opcode));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_FAIL_LINK ->
-      let t = getf event B.C.Event.io_uring_fail_link |> B.unload_fail_link in
+      let t = B.payload B.C.Fail_link.t data |> B.unload_fail_link in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_fail_link" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_fail_link"
         ~ts ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("link_ptr", `String (show_ptr t.link_ptr));
             ("opcode", `Int64 (Int64.of_int t.opcode));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_LINK ->
-      let t = getf event B.C.Event.io_uring_link |> B.unload_link in
+      let t = B.payload B.C.Link.t data |> B.unload_link in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_req ~name:"io_uring_link" ~tid ~ts correlation_id;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_link" ~ts
         ~correlation_id
         ~args:
@@ -179,16 +387,19 @@ let handle_event (writer : W.t) _ctx data _size =
             ("target_req", `String (show_ptr t.target_req_ptr));
           ]
   | B.IO_URING_REQ_FAILED ->
-      let t = getf event B.C.Event.io_uring_req_failed |> B.unload_req_failed in
+      let t = B.payload B.C.Req_failed.t data |> B.unload_req_failed in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
+      report_user_data ~name:"io_uring_req_failed" ~tid ~ts ~req:correlation_id
+        t.user_data;
       W.flow_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_req_failed"
         ~ts ~correlation_id
         ~args:
           [
             ("ring_ptr", `String (show_ptr t.ctx_ptr));
             ("req_ptr", `String (show_ptr t.req_ptr));
+            ("user_data", `Pointer t.user_data);
             ("opcode", `Int64 (Int64.of_int t.opcode));
             ("flags", `Int64 (Int64.of_int t.flags));
             ("ioprio", `Int64 (Int64.of_int t.ioprio));
@@ -202,27 +413,33 @@ let handle_event (writer : W.t) _ctx data _size =
             ("pad1", `Int64 t.pad1);
             ("addr3", `Pointer t.addr3);
             ("error", `Int64 (Int64.of_int t.error));
-            ("op_str", `String t.op_str);
+            ("op_str", `String (B.Opcode.show t.opcode));
           ]
   | B.IO_URING_COMPLETE ->
-      let t = getf event B.C.Event.io_uring_complete |> B.unload_complete in
+      let t = B.payload B.C.Complete.t data |> B.unload_complete in
       let correlation_id =
         t.req_ptr |> raw_address_of_ptr |> Int64.of_nativeint
       in
       let flag_list_str = t.cflags |> B.Cqe_flags.show in
-      W.complete_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid
-        ~name:"io_uring_complete" ~ts ~correlation_id
+      report_user_data ~name:"io_uring_complete" ~tid ~ts ~req:correlation_id
+        t.user_data;
+      (* Multishot requests keep their address until the last CQE *)
+      if not (List.mem B.MORE t.cflags) then
+        Hashtbl.remove watched_reqs correlation_id;
+      W.cqe_ev writer ~pid ~ring_ctx:t.ctx_ptr ~tid ~name:"io_uring_complete"
+        ~ts ~correlation_id
+        ~more:(List.mem B.MORE t.cflags)
         ~args:
-          [
-            ("ring_ptr", `String (show_ptr t.ctx_ptr));
-            ("req_ptr", `String (show_ptr t.req_ptr));
-            ("res", `Int64 (Int64.of_int t.res));
-            ("cflags", `String flag_list_str);
-          ]
+          ([
+             ("ring_ptr", `String (show_ptr t.ctx_ptr));
+             ("req_ptr", `String (show_ptr t.req_ptr));
+             ("user_data", `Pointer t.user_data);
+             ("res", `Int64 (Int64.of_int t.res));
+             ("cflags", `String flag_list_str);
+           ]
+          @ page_cache_args correlation_id)
   | B.IO_URING_SHORT_WRITE ->
-      let t =
-        getf event B.C.Event.io_uring_short_write |> B.unload_short_write
-      in
+      let t = B.payload B.C.Short_write.t data |> B.unload_short_write in
       W.instant_event writer ~name:"io_uring_short_write" ~pid ~tid ~ts
         ~args:
           [
@@ -232,9 +449,7 @@ let handle_event (writer : W.t) _ctx data _size =
             ("got", `Int64 t.got);
           ]
   | B.IO_URING_TASK_WORK_RUN ->
-      let t =
-        getf event B.C.Event.io_uring_task_work_run |> B.unload_task_work_run
-      in
+      let t = B.payload B.C.Task_work_run.t data |> B.unload_task_work_run in
       W.instant_event writer ~name:"io_uring_task_work_run" ~pid ~tid ~ts
         ~args:
           [
@@ -243,9 +458,7 @@ let handle_event (writer : W.t) _ctx data _size =
             ("loops", `Int64 (Int64.of_int t.loops));
           ]
   | B.IO_URING_LOCAL_WORK_RUN ->
-      let t =
-        getf event B.C.Event.io_uring_local_work_run |> B.unload_local_work_run
-      in
+      let t = B.payload B.C.Local_work_run.t data |> B.unload_local_work_run in
       W.instant_event writer ~name:"io_uring_task_work_run" ~pid ~tid ~ts
         ~args:
           [
@@ -254,9 +467,7 @@ let handle_event (writer : W.t) _ctx data _size =
             ("loops", `Int64 (Int64.of_int t.loops));
           ]
   | B.IO_URING_CQE_OVERFLOW ->
-      let t =
-        getf event B.C.Event.io_uring_cqe_overflow |> B.unload_cqe_overflow
-      in
+      let t = B.payload B.C.Cqe_overflow.t data |> B.unload_cqe_overflow in
       W.instant_event writer ~name:"io_uring_cqe_overflow" ~pid ~tid ~ts
         ~args:
           [
@@ -267,9 +478,7 @@ let handle_event (writer : W.t) _ctx data _size =
             ("ocqe_ptr", `String (show_ptr t.ocqe_ptr));
           ]
   | B.IO_URING_CQRING_WAIT ->
-      let t =
-        getf event B.C.Event.io_uring_cqring_wait |> B.unload_cqring_wait
-      in
+      let t = B.payload B.C.Cqring_wait.t data |> B.unload_cqring_wait in
       W.instant_event writer ~name:"io_uring_cqring_wait" ~pid ~tid ~ts
         ~args:
           [
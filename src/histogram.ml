@@ -0,0 +1,59 @@
+open Ctypes
+open Libbpf
+module B = Bindings
+
+(* Latency histograms aggregated in the kernel when running in
+   histogram mode, one per ring and opcode *)
+
+type t = { ring_ctx : int64; opcode : int; slots : int64 array }
+
+let read obj =
+  let map = bpf_object_find_map_by_name obj "hists" in
+  let key_ty = B.C.Hist_key.t in
+  Maps.keys ~key_ty map
+  |> List.map (fun key ->
+         let slots = Array.make B.C.Defines.hist_slots 0L in
+         Maps.percpu_lookup ~key_ty ~val_ty:B.C.Hist.t map key
+         |> List.iter (fun hist ->
+                let cpu_slots = getf hist B.C.Hist.slots in
+                Array.iteri
+                  (fun i v ->
+                    let n = CArray.get cpu_slots i in
+                    slots.(i) <- Int64.add v (Unsigned.ULLong.to_int64 n))
+                  slots);
+         let ring_ctx = getf key B.C.Hist_key.ctx in
+         let opcode = getf key B.C.Hist_key.opcode in
+         let ring_ctx = Unsigned.ULLong.to_int64 ring_ctx in
+         let opcode = Unsigned.UInt.to_int opcode in
+         { ring_ctx; opcode; slots })
+  |> List.sort compare
+
+let bar_width = 40
+
+let print_one oc { ring_ctx; opcode; slots } =
+  let total = Array.fold_left Int64.add 0L slots in
+  let peak = Array.fold_left max 1L slots in
+  Printf.fprintf oc "\nring 0x%Lx %s, %Ld requests\n" ring_ctx
+    (B.Opcode.show opcode) total;
+  Printf.fprintf oc "%24s : %-10s distribution\n" "latency (ns)" "count";
+  (* Only print from the first to the last non-empty slot *)
+  let used =
+    List.init (Array.length slots) Fun.id
+    |> List.filter (fun i -> slots.(i) > 0L)
+  in
+  match used with
+  | [] -> ()
+  | first :: _ ->
+      let last = List.fold_left max first used in
+      for i = first to last do
+        let lo = 1 lsl i and hi = (1 lsl (i + 1)) - 1 in
+        let stars = Int64.(div (mul slots.(i) (of_int bar_width)) peak) in
+        Printf.fprintf oc "%11d -> %-10d : %-10Ld |%-*s|\n" lo hi slots.(i)
+          bar_width
+          (String.make (Int64.to_int stars) '*')
+      done
+
+let print oc obj =
+  Printf.fprintf oc "\nLatency from io_uring_submit to io_uring_complete:\n";
+  List.iter (print_one oc) (read obj);
+  flush oc
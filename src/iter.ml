@@ -0,0 +1,71 @@
+open Ctypes
+open Foreign
+
+(* BPF iterators, which the Libbpf bindings don't cover. Reading the
+   fd of an iterator runs its program once per object, the programs
+   used here only act through their side effects on maps and the ring
+   buffer so the text output is thrown away *)
+
+(* Map member of union bpf_iter_link_info, for map element iterators *)
+let link_info = structure "bpf_iter_link_info"
+let map_fd = field link_info "map_fd" uint32_t
+let () = seal link_info
+
+(* struct bpf_iter_attach_opts *)
+let attach_opts = structure "bpf_iter_attach_opts"
+let sz = field attach_opts "sz" size_t
+let link_info_ptr = field attach_opts "link_info" (ptr link_info)
+let link_info_len = field attach_opts "link_info_len" uint32_t
+let () = seal attach_opts
+
+let attach_iter =
+  foreign "bpf_program__attach_iter"
+    (ptr void @-> ptr void @-> returning (ptr_opt void))
+
+let bpf_map_fd = foreign "bpf_map__fd" (ptr void @-> returning int)
+let link_fd = foreign "bpf_link__fd" (ptr void @-> returning int)
+let link_destroy = foreign "bpf_link__destroy" (ptr void @-> returning int)
+let iter_create = foreign "bpf_iter_create" (int @-> returning int)
+let read = foreign "read" (int @-> ptr void @-> size_t @-> returning long)
+let close = foreign "close" (int @-> returning int)
+
+(* Options to iterate over the elements of [map] *)
+let map_opts (map : Libbpf.bpf_map) =
+  let info = make link_info in
+  setf info map_fd (Unsigned.UInt32.of_int (bpf_map_fd (to_voidp map.ptr)));
+  let opts = make attach_opts in
+  setf opts sz (Unsigned.Size_t.of_int (sizeof attach_opts));
+  setf opts link_info_ptr (addr info);
+  setf opts link_info_len (Unsigned.UInt32.of_int (sizeof link_info));
+  (* Keep [info] alive as long as [opts] *)
+  (opts, info)
+
+let attach ?map (prog : Libbpf.bpf_program) =
+  let opts = Option.map map_opts map in
+  let opts_ptr =
+    match opts with Some (opts, _) -> to_voidp (addr opts) | None -> null
+  in
+  let link = attach_iter (to_voidp prog.ptr) opts_ptr in
+  ignore (Sys.opaque_identity opts);
+  match link with None -> failwith "Couldn't attach iterator" | Some l -> l
+
+let destroy link = ignore (link_destroy link)
+
+(* Runs the program of an attached iterator once over every object *)
+let iterate link =
+  let fd = iter_create (link_fd link) in
+  if fd < 0 then failwith "Couldn't create iterator";
+  let len = 4096 in
+  let buf = allocate_n char ~count:len in
+  let rec drain () =
+    let n =
+      read fd (to_voidp buf) (Unsigned.Size_t.of_int len) |> Signed.Long.to_int
+    in
+    if n > 0 then drain () else if n < 0 then failwith "Couldn't read iterator"
+  in
+  Fun.protect ~finally:(fun () -> ignore (close fd)) drain
+
+(* Attaches, runs and detaches, for iterators that are only run once *)
+let run ?map prog =
+  let link = attach ?map prog in
+  Fun.protect ~finally:(fun () -> destroy link) (fun () -> iterate link)
@@ -1,11 +1,51 @@
 open Cmdliner
 
-let run tracefile sampling busywait =
+let run tracefile sampling sample adaptive busywait batch batch_timeout
+    buffer_size shards stats_interval pid cgroup comm histogram slow
+    occupancy events sched block page_cache find_user_data search stacks =
   let open Driver in
-  (* Check running root *)
-  if Unix.geteuid () <> 0 then failwith "Please run as root";
-  let poll_behaviour = if busywait then Busywait else Poll 100 in
-  run ~tracefile ~sampling ~poll_behaviour
+  match search with
+  | Some path ->
+      (* Reading back a trace doesn't need root *)
+      if find_user_data = [] then failwith "--search needs --find-user-data";
+      Search.file ~find_user_data path
+  | None ->
+      (* Check running root *)
+      if Unix.geteuid () <> 0 then failwith "Please run as root";
+      (* Slow mode picks its own probes *)
+      if
+        Option.is_some slow
+        && (Option.is_some events || sched || block || page_cache)
+      then
+        failwith
+          "--slow can't be combined with --events, --sched, --block or \
+           --page-cache";
+      (* Slow records are sent on completion with their submission
+         timestamp, behind the watermark the shards are merged up to *)
+      if Option.is_some slow && Option.is_some shards then
+        failwith "--slow can't be combined with --shards";
+      (* Histogram mode doesn't stream events at all *)
+      if
+        Option.is_some histogram
+        && (Option.is_some events || sched || block || page_cache
+           || Option.is_some slow || Option.is_some stacks
+           || find_user_data <> [])
+      then
+        failwith
+          "--histogram can't be combined with --events, --sched, --block, \
+           --page-cache, --slow, --stacks or --find-user-data";
+      let poll_behaviour = if busywait then Busywait else Poll batch_timeout in
+      let target = { pid; cgroup; comm } in
+      let sampling =
+        match (sample, sampling) with
+        | Some (num, den), _ -> Some { num; den; adaptive }
+        | None, true -> Some { num = 1; den = 10; adaptive }
+        | None, false when adaptive -> Some { num = 1; den = 1; adaptive }
+        | None, false -> None
+      in
+      run ~tracefile ~sampling ~target ~histogram ~slow ~occupancy ~batch
+        ~buffer_size ~shards ~events ~sched ~block ~page_cache ~find_user_data
+        ~stacks ~poll_behaviour ~stats_interval
 
 (* Output *)
 let tracefile =
@@ -14,14 +54,195 @@ let tracefile =
 
 (* Sampling *)
 let sampling =
-  let doc = "Turn on sampling on high workloads to reduce dropping events" in
+  let doc =
+    "Turn on sampling on high workloads to reduce dropping events, this \
+     traces 1/10 of the requests"
+  in
   Arg.(value & flag (info [ "s; sampling" ] ~doc))
 
+let sample =
+  let doc = "Only trace $(docv) of the requests, e.g. 1/1000" in
+  Arg.(
+    value & opt (some Cli.ratio) None (info [ "sample" ] ~docv:"RATIO" ~doc))
+
+let adaptive =
+  let doc =
+    "Let the kernel lower the sampling rate (starting from --sample, or \
+     every request) while the ring buffer fills up or loses events, and \
+     raise it back once it drains. Requests keep every event of their \
+     lifecycle."
+  in
+  Arg.(value & flag (info [ "adaptive" ] ~doc))
+
 (* Polling *)
 let polling =
   let doc = "Turn on busywaiting on high workloads to reduce dropping events" in
   Arg.(value & flag (info [ "b; busywait" ] ~doc))
 
+(* Wakeup batching *)
+let batch =
+  let doc =
+    "Only wake up the consumer once $(docv) bytes of events are waiting in \
+     the ring buffer, so that each wakeup drains a large batch"
+  in
+  Arg.(
+    value & opt (some Cli.positive) None (info [ "batch" ] ~docv:"BYTES" ~doc))
+
+let batch_timeout =
+  let doc =
+    "Poll timeout, after which events waiting below the --batch watermark \
+     are drained anyway"
+  in
+  Arg.(value & opt int 100 (info [ "batch-timeout" ] ~docv:"MS" ~doc))
+
+(* Ring buffer *)
+let buffer_size =
+  let doc =
+    "Size of the kernel ring buffer in bytes, rounded up to a power of 2 \
+     (default 1 MiB). The peak fill level is printed on exit to help pick \
+     one."
+  in
+  Arg.(value & opt (some int) None (info [ "buffer-size" ] ~docv:"BYTES" ~doc))
+
+let shards =
+  let doc =
+    "Spread events over $(docv) ring buffers (at most 8), CPUs writing to \
+     the ring buffer of their CPU number modulo $(docv). Each one is drained \
+     by its own domain and the events are merged back in timestamp order. \
+     Every ring buffer gets the --buffer-size."
+  in
+  let n = Cli.bounded ~min:1 ~max:Shards.max_shards in
+  Arg.(value & opt (some n) None (info [ "shards" ] ~docv:"N" ~doc))
+
+(* Statistics *)
+let stats_interval =
+  let doc =
+    "Print the kernel-side event counters every $(docv) seconds while tracing"
+  in
+  Arg.(value & opt (some float) None (info [ "stats" ] ~docv:"SECONDS" ~doc))
+
+(* Targeting *)
+let pid =
+  let doc = "Only trace rings set up by the process with this $(docv)" in
+  Arg.(value & opt (some int) None (info [ "p"; "pid" ] ~docv:"PID" ~doc))
+
+let cgroup =
+  let doc =
+    "Only trace rings set up by tasks in this cgroup v2 directory, e.g. \
+     /sys/fs/cgroup/system.slice/foo.service"
+  in
+  Arg.(value & opt (some dir) None (info [ "cgroup" ] ~docv:"PATH" ~doc))
+
+let comm =
+  let doc = "Only trace rings set up by tasks with this command name" in
+  Arg.(value & opt (some string) None (info [ "comm" ] ~docv:"NAME" ~doc))
+
+(* Histogram mode *)
+let histogram =
+  let doc =
+    "Don't stream request events, instead time requests in the kernel and \
+     print per-ring, per-opcode latency histograms every $(docv) seconds \
+     and on exit"
+  in
+  Arg.(
+    value & opt (some float) None (info [ "histogram" ] ~docv:"SECONDS" ~doc))
+
+(* Slow requests *)
+let slow =
+  let doc =
+    "Only send requests that took at least $(docv) from submission to \
+     completion, e.g. 5ms. Requests are held in the kernel while in \
+     flight, their intermediate events only keep their type, thread and \
+     time. Other events aren't traced in this mode."
+  in
+  Arg.(
+    value
+    & opt (some Cli.duration) None (info [ "slow" ] ~docv:"DURATION" ~doc))
+
+(* Ring occupancy *)
+let occupancy =
+  let doc =
+    "Sample the SQ and CQ depth of every traced ring each $(docv) \
+     milliseconds (at most once per --batch-timeout) and when \
+     io_uring_enter returns (with the syscalls category), drawn as counter \
+     tracks per ring"
+  in
+  Arg.(
+    value & opt (some Cli.positive) None (info [ "occupancy" ] ~docv:"MS" ~doc))
+
+(* Event categories *)
+let events =
+  let categories = List.map (fun (c, _) -> (c, c)) Site.categories in
+  let doc =
+    Printf.sprintf
+      "Only attach the probes of these event categories, a comma separated \
+       list of %s. Defaults to all of them but sched, block and page_cache. \
+       Categories can also be switched on and off while tracing by typing \
+       +CATEGORY or -CATEGORY followed by Enter."
+      (Arg.doc_alts_enum categories)
+  in
+  Arg.(
+    value
+    & opt (some (list (enum categories))) None
+    & info [ "events" ] ~docv:"CATEGORIES" ~doc)
+
+(* Scheduler states *)
+let sched =
+  let doc =
+    "Also trace context switches and wakeups of the threads seen using \
+     rings (submitters and io-workers), drawn as running, runnable and \
+     blocked slices on a sched track next to each thread"
+  in
+  Arg.(value & flag (info [ "sched" ] ~doc))
+
+(* Block layer *)
+let block =
+  let doc =
+    "Also trace block requests issued on behalf of io_uring requests, drawn \
+     as block_queue and block_device spans to split a request's latency \
+     into io_uring, queueing and device time (O_DIRECT and IOPOLL rings)"
+  in
+  Arg.(value & flag (info [ "block" ] ~doc))
+
+(* Page cache *)
+let page_cache =
+  let doc =
+    "Also trace page cache lookups and insertions on behalf of io_uring \
+     requests. Completions of buffered requests get whether their pages \
+     were cached and how many pages readahead added, and each ring gets a \
+     page cache hit ratio counter track."
+  in
+  Arg.(value & flag (info [ "page-cache" ] ~doc))
+
+(* Searching *)
+let find_user_data =
+  let doc =
+    "Report every event of the requests with this SQE user_data (decimal or \
+     0x-prefixed hex) on stdout while tracing, with its thread and \
+     timestamp, from submission to the last CQE including io-wq work and \
+     block requests. Can be repeated. user_data is also attached to every \
+     request event in the trace."
+  in
+  Arg.(
+    value & opt_all int64 [] (info [ "find-user-data" ] ~docv:"USER_DATA" ~doc))
+
+let search =
+  let doc =
+    "Instead of tracing, report the events of the --find-user-data requests \
+     found in the trace $(docv) recorded earlier"
+  in
+  Arg.(value & opt (some file) None (info [ "search" ] ~docv:"FILE" ~doc))
+
+(* Stacks *)
+let stacks =
+  let doc =
+    "Capture the user-space stack of one in $(docv) submissions and attach \
+     it, symbolised from the ELF symbol tables of the submitting process, \
+     to the submit event. Needs binaries built with frame pointers."
+  in
+  Arg.(
+    value & opt (some Cli.positive) None (info [ "stacks" ] ~docv:"N" ~doc))
+
 let cmd =
   let doc = "Visualize uring events" in
   let desc_blk =
@@ -46,6 +267,11 @@ let cmd =
   in
   let man : Manpage.block list = [ `Blocks desc_blk; `Blocks usage_blk ] in
   let info = Cmd.info "uring-trace" ~doc ~man in
-  Cmd.v info Term.(const run $ tracefile $ sampling $ polling)
+  Cmd.v info
+    Term.(
+      const run $ tracefile $ sampling $ sample $ adaptive $ polling $ batch
+      $ batch_timeout $ buffer_size $ shards $ stats_interval $ pid $ cgroup
+      $ comm $ histogram $ slow $ occupancy $ events $ sched $ block
+      $ page_cache $ find_user_data $ search $ stacks)
 
 let () = exit (Cmd.eval cmd)
@@ -0,0 +1,81 @@
+open Ctypes
+open Libbpf
+module F = C.Functions
+
+(* Helpers for the map types that the Libbpf convenience functions
+   don't cover *)
+
+(* Same parsing that libbpf_num_possible_cpus does on
+   /sys/devices/system/cpu/possible, i.e. "0-63" or "0,2-5" *)
+let possible_cpus =
+  lazy
+    (let ic = open_in "/sys/devices/system/cpu/possible" in
+     let line =
+       Fun.protect ~finally:(fun () -> close_in ic) (fun () -> input_line ic)
+     in
+     String.split_on_char ',' (String.trim line)
+     |> List.fold_left
+          (fun acc range ->
+            match String.split_on_char '-' range with
+            | [ n ] -> max acc (int_of_string n + 1)
+            | [ _; hi ] -> max acc (int_of_string hi + 1)
+            | _ -> failwith "Couldn't parse possible cpus")
+          0)
+
+let size_t n = Unsigned.Size_t.of_int n
+
+let lookup ~key_ty ~val_ty (map : bpf_map) k =
+  let key = allocate key_ty k in
+  let value = allocate_n val_ty ~count:1 in
+  let err =
+    F.bpf_map__lookup_elem map.ptr (to_voidp key)
+      (size_t (sizeof key_ty))
+      (to_voidp value)
+      (size_t (sizeof val_ty))
+      Unsigned.UInt64.zero
+  in
+  if err <> 0 then None else Some !@value
+
+let delete_elem =
+  Foreign.foreign "bpf_map__delete_elem"
+    (ptr void @-> ptr void @-> Ctypes.size_t @-> uint64_t @-> returning int)
+
+let delete ~key_ty (map : bpf_map) k =
+  let key = allocate key_ty k in
+  delete_elem (to_voidp map.ptr) (to_voidp key)
+    (size_t (sizeof key_ty))
+    Unsigned.UInt64.zero
+  |> ignore
+
+(* Per-CPU maps return one value per possible CPU on lookup *)
+let percpu_lookup ~key_ty ~val_ty (map : bpf_map) k =
+  let ncpus = Lazy.force possible_cpus in
+  let key = allocate key_ty k in
+  let values = CArray.make val_ty ncpus in
+  let err =
+    F.bpf_map__lookup_elem map.ptr (to_voidp key)
+      (size_t (sizeof key_ty))
+      (to_voidp (CArray.start values))
+      (size_t (ncpus * sizeof val_ty))
+      Unsigned.UInt64.zero
+  in
+  if err <> 0 then failwith (Printf.sprintf "Per-CPU lookup failed (%d)" err)
+  else CArray.to_list values
+
+let percpu_max_long map idx =
+  percpu_lookup ~key_ty:Ctypes.int ~val_ty:Ctypes.long map idx
+  |> List.fold_left (fun acc v -> max acc (Signed.Long.to_int64 v)) 0L
+
+let percpu_sum_long map idx =
+  percpu_lookup ~key_ty:Ctypes.int ~val_ty:Ctypes.long map idx
+  |> List.fold_left (fun acc v -> Int64.add acc (Signed.Long.to_int64 v)) 0L
+
+(* All keys currently in a hash map *)
+let keys ~key_ty (map : bpf_map) =
+  let size = size_t (sizeof key_ty) in
+  let rec loop acc prev =
+    let next = allocate_n key_ty ~count:1 in
+    let err = F.bpf_map__get_next_key map.ptr prev (to_voidp next) size in
+    if err <> 0 then List.rev acc else loop (!@next :: acc) (to_voidp next)
+  in
+  loop [] null
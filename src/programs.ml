@@ -0,0 +1,60 @@
+open Ctypes
+open Foreign
+
+(* Picks which programs of the object get loaded, which the Libbpf
+   bindings don't cover. fentry, fexit and tp_btf programs are checked
+   against their attach point at load time, so a single one missing
+   from the running kernel fails the whole object *)
+
+let next_program =
+  foreign "bpf_object__next_program"
+    (ptr void @-> ptr void @-> returning (ptr_opt void))
+
+let name = foreign "bpf_program__name" (ptr void @-> returning string)
+
+let section_name =
+  foreign "bpf_program__section_name" (ptr void @-> returning string)
+
+let set_autoload =
+  foreign "bpf_program__set_autoload" (ptr void @-> bool @-> returning int)
+
+let autoload = foreign "bpf_program__autoload" (ptr void @-> returning bool)
+
+(* Whether the attach point named by the section exists, functions and
+   tracepoints both appear in the kernel's BTF *)
+let available section =
+  match String.split_on_char '/' section with
+  | ("fentry" | "fexit" | "kprobe") :: fn :: _ -> Btf.has_function fn
+  | "tp_btf" :: tp :: _ -> Btf.has_type ("btf_trace_" ^ tp)
+  | _ -> true
+
+(* Kernels before 6.3 only have the older io_uring_submit_sqe
+   tracepoint and kernels before 5.16 mark pages rather than folios as
+   accessed, the object carries a handler for each *)
+let variant = function
+  | "handle_submit_req"
+    when not (Btf.has_type "trace_event_raw_io_uring_submit_req") ->
+      "handle_submit_sqe"
+  | "handle_folio_mark_accessed"
+    when not (Btf.has_function "folio_mark_accessed") ->
+      "handle_mark_page_accessed"
+  | name -> name
+
+(* Only loads the programs in [names] whose attach point exists *)
+let select (obj : Libbpf.bpf_object) names =
+  let obj = to_voidp obj in
+  let rec loop prev =
+    match next_program obj prev with
+    | None -> ()
+    | Some prog ->
+        let load =
+          List.mem (name prog) names && available (section_name prog)
+        in
+        if set_autoload prog load <> 0 then
+          failwith ("Couldn't set autoload of " ^ name prog);
+        loop prog
+  in
+  loop null
+
+(* Programs left out by [select] can't be attached *)
+let loaded (prog : Libbpf.bpf_program) = autoload (to_voidp prog.ptr)
@@ -0,0 +1,22 @@
+(* --find-user-data over a recorded trace. Request flows use the
+   request's address as correlation id, and the flow events that carry
+   a user_data argument tie the request to it, the same way Handler
+   does while tracing *)
+
+let report (e : Fxt.Read.event) =
+  match (e.kind, e.correlation_id) with
+  | ((`Flow_begin | `Flow_step | `Flow_end) as kind), Some req ->
+      let name = e.name and tid = e.thread.Fxt.Write.tid and ts = e.ts in
+      (match List.assoc_opt "user_data" e.args with
+      | Some (`Pointer user_data) ->
+          Handler.report_user_data ~name ~tid ~ts ~req user_data
+      | _ -> Handler.report_req ~name ~tid ~ts req);
+      (* The last CQE ends the flow *)
+      if kind = `Flow_end then Hashtbl.remove Handler.watched_reqs req
+  | _ -> ()
+
+let file ~find_user_data path =
+  List.iter
+    (fun v -> Hashtbl.replace Handler.watched_user_data v ())
+    find_user_data;
+  In_channel.with_open_bin path (Fxt.Read.iter report)
@@ -0,0 +1,138 @@
+open Ctypes
+open Foreign
+open Libbpf
+module B = Bindings
+
+(* Sharded mode: every group of CPUs writes to its own ring buffer
+   (rb_0 .. rb_7 in uring.bpf.c). Each shard is drained by its own
+   domain into a queue of copied records, and the main domain merges
+   the queues on their timestamps before handing records over to the
+   handler, so the trace stays in time order *)
+
+let max_shards = B.C.Defines.max_shards
+
+(* struct timespec, to read the clock behind bpf_ktime_get_ns *)
+let timespec = structure "timespec"
+let tv_sec = field timespec "tv_sec" long
+let tv_nsec = field timespec "tv_nsec" long
+let () = seal timespec
+let clock_monotonic = 1
+
+let clock_gettime =
+  foreign "clock_gettime" (int @-> ptr timespec @-> returning int)
+
+let now () =
+  let t = make timespec in
+  ignore (clock_gettime clock_monotonic (addr t));
+  Int64.(
+    add
+      (mul (Signed.Long.to_int64 (getf t tv_sec)) 1_000_000_000L)
+      (Signed.Long.to_int64 (getf t tv_nsec)))
+
+type record = { ts : int64; data : string }
+
+type shard = {
+  mutex : Mutex.t;
+  mutable incoming : record Queue.t;
+  (* Everything the shard holds from before this time has been pushed
+     to [incoming], published by the draining domain after each poll *)
+  polled : int64 Atomic.t;
+  (* Only touched by the main domain *)
+  pending : record Queue.t;
+}
+
+let make_shard () =
+  {
+    mutex = Mutex.create ();
+    incoming = Queue.create ();
+    polled = Atomic.make 0L;
+    pending = Queue.create ();
+  }
+
+(* Records only live as long as the ring buffer callback, copy them
+   out before releasing the slot *)
+let copy_record shard _ctx data size =
+  let event = !@(from_voidp B.C.Event.t data) in
+  let ts = getf event B.C.Event.ts |> Unsigned.UInt64.to_int64 in
+  let data = string_from_ptr (from_voidp char data) ~length:size in
+  Mutex.protect shard.mutex (fun () -> Queue.push { ts; data } shard.incoming);
+  0
+
+(* A record is timestamped right after its slot is reserved but only
+   becomes visible once committed, and the consumer stops at the first
+   uncommitted slot. Marks are held back by this much so that records
+   still being written when a poll started can't end up below them *)
+let horizon ~timeout = Int64.of_int (2 * timeout * 1_000_000)
+
+let drain obj ~cont ~timeout i shard =
+  let map = bpf_object_find_map_by_name obj (Printf.sprintf "rb_%d" i) in
+  Libbpf_maps.RingBuffer.init map ~callback:(copy_record shard) (fun rb ->
+      while Atomic.get cont do
+        let start = now () in
+        let n = Libbpf_maps.RingBuffer.poll rb ~timeout in
+        (* Also drains events batched below the wakeup watermark *)
+        if n = 0 then ignore (Libbpf_maps.RingBuffer.consume rb);
+        Atomic.set shard.polled (Int64.sub start (horizon ~timeout))
+      done;
+      ignore (Libbpf_maps.RingBuffer.consume rb))
+
+let collect shard =
+  let incoming =
+    Mutex.protect shard.mutex (fun () ->
+        let q = shard.incoming in
+        shard.incoming <- Queue.create ();
+        q)
+  in
+  Queue.transfer incoming shard.pending
+
+(* Records can only be released up to the oldest mark of all shards,
+   idle ones included: any shard could still deliver anything newer.
+   The marks must be read before collecting, everything they cover is
+   then in the pending queues *)
+let watermark shards =
+  Array.fold_left
+    (fun acc shard -> min acc (Atomic.get shard.polled))
+    Int64.max_int shards
+
+(* k-way merge, the shards are few enough to find the oldest head with
+   a linear scan *)
+let rec release shards ~upto f =
+  let oldest =
+    Array.fold_left
+      (fun acc shard ->
+        match (Queue.peek_opt shard.pending, acc) with
+        | None, _ -> acc
+        | Some r, Some (best, _) when r.ts >= best.ts -> acc
+        | Some r, _ -> Some (r, shard))
+      None shards
+  in
+  match oldest with
+  | Some (r, shard) when r.ts <= upto ->
+      ignore (Queue.pop shard.pending);
+      f r;
+      release shards ~upto f
+  | _ -> ()
+
+let handle_record handle r =
+  let data = CArray.of_string r.data in
+  let size = String.length r.data in
+  ignore (handle null (to_voidp (CArray.start data)) size)
+
+let consume obj ~shards:n ~cont ~timeout ~tick handle =
+  let shards = Array.init n (fun _ -> make_shard ()) in
+  let domains =
+    Array.mapi
+      (fun i shard -> Domain.spawn (fun () -> drain obj ~cont ~timeout i shard))
+      shards
+  in
+  while Atomic.get cont do
+    Unix.sleepf (float_of_int timeout /. 1000.);
+    let upto = watermark shards in
+    Array.iter collect shards;
+    release shards ~upto (handle_record handle);
+    tick ()
+  done;
+  Array.iter Domain.join domains;
+  (* Everything has been drained, flush the rest in order *)
+  Array.iter collect shards;
+  release shards ~upto:Int64.max_int (handle_record handle)
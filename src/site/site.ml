@@ -6,30 +6,122 @@ let lookup_bpf_object_path filename =
 
 let bpf_object_path = lookup_bpf_object_path "uring-trace.bpf.o"
 
+(* Always attached, events are only traced on rings seen being
+   created and until they are released *)
+let ring_program_names = [ "handle_create"; "handle_ring_release" ]
+
+(* Only attached with --sched, these fire on every context switch *)
+let sched_program_names = [ "handle_sched_switch"; "handle_sched_wakeup" ]
+
+(* Requests punted to io-wq are issued by a worker, these set and clear
+   the request a thread is issuing for the block and page_cache
+   categories. Programs shared by categories stay attached while any of
+   them is on *)
+let issuing_program_names =
+  [
+    "handle_issue_sqe_end";
+    "handle_queue_async_work";
+    "handle_io_wq_work_begin";
+    "handle_io_wq_work_end";
+  ]
+
+(* Only attached with --block *)
+let block_program_names =
+  issuing_program_names
+  @ [
+      "handle_block_bio_queue";
+      "handle_block_rq_insert";
+      "handle_block_rq_issue";
+      "handle_block_rq_complete";
+    ]
+
+(* Only attached with --page-cache *)
+let page_cache_program_names =
+  issuing_program_names
+  @ [ "handle_filemap_add"; "handle_folio_mark_accessed" ]
+
+(* Programs by event category, picked with --events and attached or
+   detached while tracing *)
+let categories =
+  [
+    ("register", [ "handle_register" ]);
+    ("submit", [ "handle_submit_req" ]);
+    ( "request",
+      [
+        "handle_file_get";
+        "handle_queue_async_work";
+        "handle_poll_arm";
+        "handle_task_add";
+        "handle_short_write";
+        "handle_defer";
+        "handle_link";
+        "handle_fail_link";
+        "handle_req_failed";
+      ] );
+    ("complete", [ "handle_complete"; "handle_cqe_overflow" ]);
+    ( "worker",
+      [
+        "handle_io_init_new_worker";
+        "handle_io_wq_work_begin";
+        "handle_io_wq_work_end";
+      ] );
+    ("task_work", [ "handle_task_work_run"; "handle_local_work_run" ]);
+    ("wait", [ "handle_cqring_wait" ]);
+    ( "syscalls",
+      [
+        "handle_sys_enter_io_uring_setup";
+        "handle_sys_exit_io_uring_setup";
+        "handle_sys_enter_io_uring_register";
+        "handle_sys_exit_io_uring_register";
+        "handle_sys_enter_io_uring_enter";
+        "handle_sys_exit_io_uring_enter";
+      ] );
+    ("sched", sched_program_names);
+    ("block", block_program_names);
+    ("page_cache", page_cache_program_names);
+  ]
+
+(* Everything but the costly sched, block and page_cache categories *)
+let default_categories =
+  List.map fst categories
+  |> List.filter (fun c -> not (List.mem c [ "sched"; "block"; "page_cache" ]))
+
+let category_program_names cats =
+  List.concat_map (fun c -> List.assoc c categories) cats
+
 let bpf_program_names =
+  ring_program_names @ category_program_names default_categories
+
+(* Iterator run once at startup to pick up rings that already exist *)
+let snapshot_program_name = "snapshot_rings"
+
+(* Iterator over the rings map, run periodically with --occupancy *)
+let occupancy_program_name = "sample_occupancy"
+
+(* Slow mode only sends the events of slow requests, the other
+   tracepoints would fill the ring buffer with everything else *)
+let slow_program_names =
   [
     "handle_create";
-    "handle_register";
+    "handle_ring_release";
     "handle_file_get";
     "handle_submit_req";
     "handle_queue_async_work";
     "handle_poll_arm";
     "handle_task_add";
-    "handle_task_work_run";
-    "handle_short_write";
-    "handle_local_work_run";
     "handle_defer";
     "handle_link";
     "handle_fail_link";
-    "handle_cqring_wait";
     "handle_req_failed";
-    "handle_cqe_overflow";
     "handle_complete";
-    "handle_io_init_new_worker";
-    "handle_sys_enter_io_uring_setup";
-    "handle_sys_exit_io_uring_setup";
-    "handle_sys_enter_io_uring_register";
-    "handle_sys_exit_io_uring_register";
-    "handle_sys_enter_io_uring_enter";
-    "handle_sys_exit_io_uring_enter";
+  ]
+
+(* Histogram mode only needs to see rings being created and requests
+   being submitted and completed *)
+let histogram_program_names =
+  [
+    "handle_create";
+    "handle_ring_release";
+    "handle_submit_req";
+    "handle_complete";
   ]
@@ -0,0 +1,196 @@
+(* Resolves user-space addresses from sampled stacks to function names,
+   using /proc/<pid>/maps and the ELF symbol tables of the mapped
+   files. Only symbol tables are read, frames are as good as the frame
+   pointers the kernel walked to collect them *)
+
+type mapping = {
+  start : int64;
+  stop : int64;
+  offset : int64;
+  (* Device and inode *)
+  file : string;
+  path : string;
+}
+
+type elf = {
+  (* PT_LOAD segments as (file offset, vaddr, size) *)
+  loads : (int64 * int64 * int64) list;
+  (* Function symbols as (value, size, name), sorted by value *)
+  funcs : (int64 * int64 * string) array;
+}
+
+let u16 s off = String.get_uint16_le s off
+let u32 s off = Int32.to_int (String.get_int32_le s off) land 0xffff_ffff
+let u64 s off = String.get_int64_le s off
+
+(* [len] bytes at [off] of the file, sizes come from the file itself so
+   check them before allocating anything *)
+let read_range ic off len =
+  let left () = Int64.(sub (In_channel.length ic) (of_int off)) in
+  if off < 0 || len < 0 || Int64.compare (Int64.of_int len) (left ()) > 0 then
+    invalid_arg "Symbolize.read_range"
+  else (
+    In_channel.seek ic (Int64.of_int off);
+    really_input_string ic len)
+
+let c_string s off =
+  match String.index_from_opt s off '\x00' with
+  | Some stop -> String.sub s off (stop - off)
+  | None -> ""
+
+(* ELF64 little-endian only, which covers the architectures the probes
+   are built for. [read off len] returns a range of the file, only the
+   headers and the symbol table are read. Truncated or malformed files
+   give None *)
+let parse_elf_exn read =
+  let h = read 0 64 in
+  if String.sub h 0 4 <> "\x7fELF" || h.[4] <> '\x02' then None
+  else
+    let phoff = Int64.to_int (u64 h 0x20) in
+    let shoff = Int64.to_int (u64 h 0x28) in
+    let phentsize = u16 h 0x36 and phnum = u16 h 0x38 in
+    let shentsize = u16 h 0x3a and shnum = u16 h 0x3c in
+    let ph = read phoff (phnum * phentsize) in
+    let loads =
+      List.init phnum (fun i -> i * phentsize)
+      |> List.filter (fun p -> u32 ph p = 1 (* PT_LOAD *))
+      |> List.map (fun p -> (u64 ph (p + 8), u64 ph (p + 16), u64 ph (p + 32)))
+    in
+    let sh = read shoff (shnum * shentsize) in
+    let section i = i * shentsize in
+    let contents s =
+      read (Int64.to_int (u64 sh (s + 0x18))) (Int64.to_int (u64 sh (s + 0x20)))
+    in
+    let symbols s =
+      let syms = contents s in
+      let strtab = contents (section (u32 sh (s + 0x28))) in
+      List.init (String.length syms / 24) (fun i -> i * 24)
+      (* STT_FUNC with a value *)
+      |> List.filter (fun sym ->
+             Char.code syms.[sym + 4] land 0xf = 2 && u64 syms (sym + 8) <> 0L)
+      |> List.map (fun sym ->
+             ( u64 syms (sym + 8),
+               u64 syms (sym + 16),
+               c_string strtab (u32 syms sym) ))
+    in
+    (* Prefer .symtab, stripped binaries only have .dynsym *)
+    let find ty =
+      List.init shnum section |> List.find_opt (fun s -> u32 sh (s + 4) = ty)
+    in
+    let funcs =
+      match (find 2, find 11) with
+      | Some s, _ | None, Some s -> symbols s
+      | None, None -> []
+    in
+    let funcs = Array.of_list funcs in
+    Array.sort (fun (a, _, _) (b, _, _) -> Int64.unsigned_compare a b) funcs;
+    Some { loads; funcs }
+
+let parse_elf read =
+  try parse_elf_exn read with End_of_file | Invalid_argument _ -> None
+
+(* Cached by device and inode, the same file can be mapped under
+   different paths from different mount namespaces *)
+let elfs : (string, elf option) Hashtbl.t = Hashtbl.create 16
+
+let elf pid m =
+  match Hashtbl.find_opt elfs m.file with
+  | Some elf -> elf
+  | None ->
+      (* The path is relative to the root of the process *)
+      let path = Printf.sprintf "/proc/%Ld/root%s" pid m.path in
+      let elf =
+        try In_channel.with_open_bin path (fun ic -> parse_elf (read_range ic))
+        with Sys_error _ -> None
+      in
+      Hashtbl.replace elfs m.file elf;
+      elf
+
+let parse_maps pid =
+  let parse line =
+    match String.split_on_char ' ' line |> List.filter (( <> ) "") with
+    | range :: _perms :: offset :: dev :: inode :: path :: _
+      when String.length path > 0 && path.[0] = '/' -> (
+        match String.split_on_char '-' range with
+        | [ start; stop ] ->
+            let hex x = Int64.of_string ("0x" ^ x) in
+            Some
+              {
+                start = hex start;
+                stop = hex stop;
+                offset = hex offset;
+                file = dev ^ " " ^ inode;
+                path;
+              }
+        | _ -> None)
+    | _ -> None
+  in
+  try
+    In_channel.with_open_text (Printf.sprintf "/proc/%Ld/maps" pid)
+      In_channel.input_all
+    |> String.split_on_char '\n'
+    |> List.filter_map parse
+  with Sys_error _ -> []
+
+let maps : (int64, mapping list) Hashtbl.t = Hashtbl.create 16
+
+let in_mapping addr m =
+  Int64.unsigned_compare addr m.start >= 0
+  && Int64.unsigned_compare addr m.stop < 0
+
+(* Mappings are cached per process and reread when an address falls
+   outside all of them, e.g. after a dlopen *)
+let find_mapping pid addr =
+  let find () =
+    List.find_opt (in_mapping addr)
+      (Option.value ~default:[] (Hashtbl.find_opt maps pid))
+  in
+  match find () with
+  | Some m -> Some m
+  | None ->
+      Hashtbl.replace maps pid (parse_maps pid);
+      find ()
+
+(* Greatest symbol starting at or before [vaddr] *)
+let lookup funcs vaddr =
+  let rec search lo hi =
+    if lo >= hi then lo - 1
+    else
+      let mid = (lo + hi) / 2 in
+      let value, _, _ = funcs.(mid) in
+      if Int64.unsigned_compare value vaddr <= 0 then search (mid + 1) hi
+      else search lo mid
+  in
+  match search 0 (Array.length funcs) with
+  | -1 -> None
+  | i ->
+      let value, size, name = funcs.(i) in
+      let off = Int64.sub vaddr value in
+      if size = 0L || Int64.unsigned_compare off size < 0 then Some (name, off)
+      else None
+
+let frame pid addr =
+  match find_mapping pid addr with
+  | None -> Printf.sprintf "0x%Lx" addr
+  | Some m -> (
+      let file_off = Int64.(add (sub addr m.start) m.offset) in
+      let base = Filename.basename m.path in
+      let vaddr elf =
+        List.find_map
+          (fun (off, vaddr, size) ->
+            let rel = Int64.sub file_off off in
+            if Int64.compare rel 0L >= 0 && Int64.compare rel size < 0 then
+              Some (Int64.add vaddr rel)
+            else None)
+          elf.loads
+      in
+      match elf pid m with
+      | None -> Printf.sprintf "0x%Lx (%s)" file_off base
+      | Some elf -> (
+          match Option.bind (vaddr elf) (lookup elf.funcs) with
+          | Some (name, off) -> Printf.sprintf "%s+0x%Lx (%s)" name off base
+          | None -> Printf.sprintf "0x%Lx (%s)" file_off base))
+
+(* Innermost frame first, the stack map pads the rest with zeros *)
+let stack pid addrs =
+  List.filter (( <> ) 0L) addrs |> List.map (frame pid) |> String.concat "\n"
@@ -22,13 +22,48 @@ end
 module RingCtxSet = Set.Make (RingCtxPtr)
 module TrackSet = Set.Make (Track)
 
+(* A multishot request between its first and last CQE *)
+type multishot = {
+  mutable cqes : int;
+  first_ts : int64;
+  mutable last_ts : int64;
+  mutable max_gap : int64;
+}
+
 type t = {
   mutable rings : RingCtxSet.t;
   mutable tracks : TrackSet.t;
+  (* Current scheduler state slice of each tracked tid *)
+  sched : (int64, string) Hashtbl.t;
+  (* Threads with an open syscall slice *)
+  syscalls : (int64, unit) Hashtbl.t;
+  (* io-wq workers with an open work span *)
+  working : (int64, unit) Hashtbl.t;
+  (* Block requests with an open block_queue span *)
+  block_queued : (int64, unit) Hashtbl.t;
+  (* Block requests with an open block_device span *)
+  block_issued : (int64, unit) Hashtbl.t;
+  (* Requests that hit the page cache and requests that went through
+     it, per ring *)
+  page_cache : (int64, int * int) Hashtbl.t;
+  (* Multishot requests that posted a CQE flagged MORE *)
+  multishot : (int64, multishot) Hashtbl.t;
   fxt : FW.t;
 }
 
-let make fxt = { rings = RingCtxSet.empty; tracks = TrackSet.empty; fxt }
+let make fxt =
+  {
+    rings = RingCtxSet.empty;
+    tracks = TrackSet.empty;
+    sched = Hashtbl.create 64;
+    syscalls = Hashtbl.create 64;
+    working = Hashtbl.create 64;
+    block_queued = Hashtbl.create 64;
+    block_issued = Hashtbl.create 64;
+    page_cache = Hashtbl.create 8;
+    multishot = Hashtbl.create 64;
+    fxt;
+  }
 let of_writer = FW.of_writer
 
 let create_ring_ev ?args t ~ring_ctx ~pid ~tid ~name ~comm ~ts =
@@ -78,16 +113,186 @@ let flow_instance_aux ?args t ~ring_ctx ~name ~pid ~tid ~ts ~correlation_id
     FW.duration_end t.fxt ~name ~thread ~category ~ts ?args)
   else Printf.eprintf "No registered ring found for submission event\n%!\n"
 
-let submit_ev = flow_instance_aux ~flow_ev:`Start
+let submit_ev ?args t ~ring_ctx ~name ~pid ~tid ~ts ~correlation_id =
+  (* Request addresses get reused, close the span of a multishot
+     request whose last CQE went missing *)
+  if Hashtbl.mem t.multishot correlation_id then (
+    Hashtbl.remove t.multishot correlation_id;
+    FW.async_end t.fxt ~name:"multishot" ~thread:FW.{ pid; tid } ~category ~ts
+      ~correlation_id);
+  flow_instance_aux ?args t ~ring_ctx ~name ~pid ~tid ~ts ~correlation_id
+    ~flow_ev:`Start
+
 let flow_ev = flow_instance_aux ~flow_ev:`Step
 let complete_ev = flow_instance_aux ~flow_ev:`End
 
+(* Multishot requests (accept, recv, poll...) post CQEs flagged MORE
+   until their last one. They get an async span from the first CQE to
+   the last with an instant per CQE, and their flow only ends on the
+   last CQE *)
+let cqe_ev ?(args = []) t ~ring_ctx ~name ~pid ~tid ~ts ~correlation_id ~more
+    =
+  let thread = FW.{ pid; tid } in
+  let state =
+    match Hashtbl.find_opt t.multishot correlation_id with
+    | Some s -> Some s
+    | None when more && RingCtxSet.mem ring_ctx t.rings ->
+        let s = { cqes = 0; first_ts = ts; last_ts = ts; max_gap = 0L } in
+        Hashtbl.replace t.multishot correlation_id s;
+        FW.async_begin t.fxt ~name:"multishot" ~thread ~category ~ts
+          ~correlation_id;
+        Some s
+    | None -> None
+  in
+  match state with
+  | None -> complete_ev ~args t ~ring_ctx ~name ~pid ~tid ~ts ~correlation_id
+  | Some s ->
+      let gap = Int64.sub ts s.last_ts in
+      s.cqes <- s.cqes + 1;
+      s.last_ts <- ts;
+      s.max_gap <- max s.max_gap gap;
+      let cqe_args =
+        [ ("cqe", `Int64 (Int64.of_int s.cqes)); ("gap_ns", `Int64 gap) ]
+      in
+      FW.async_instant ~args:cqe_args t.fxt ~name:"cqe" ~thread ~category ~ts
+        ~correlation_id;
+      if more then
+        flow_ev ~args:(args @ cqe_args) t ~ring_ctx ~name ~pid ~tid ~ts
+          ~correlation_id
+      else (
+        Hashtbl.remove t.multishot correlation_id;
+        let mean_gap =
+          if s.cqes < 2 then 0L
+          else Int64.(div (sub ts s.first_ts) (of_int (s.cqes - 1)))
+        in
+        let summary =
+          [
+            ("cqes", `Int64 (Int64.of_int s.cqes));
+            ("mean_gap_ns", `Int64 mean_gap);
+            ("max_gap_ns", `Int64 s.max_gap);
+          ]
+        in
+        FW.async_end ~args:summary t.fxt ~name:"multishot" ~thread ~category
+          ~ts ~correlation_id;
+        complete_ev ~args:(args @ summary) t ~ring_ctx ~name ~pid ~tid ~ts
+          ~correlation_id)
+
+(* Span of an io-wq worker running a request, linked into the request's
+   flow *)
+let work_begin ?args t ~ring_ctx ~pid ~tid ~name ~ts ~correlation_id =
+  if RingCtxSet.mem ring_ctx t.rings then (
+    let thread = FW.{ pid; tid } in
+    Hashtbl.replace t.working tid ();
+    FW.duration_begin ?args t.fxt ~name ~thread ~category ~ts;
+    FW.flow_step t.fxt ~name ~thread ~category ~ts ~correlation_id)
+
+(* The begin can be missing, lost or from before tracing started *)
+let work_end ?args t ~ring_ctx ~pid ~tid ~name ~ts =
+  if RingCtxSet.mem ring_ctx t.rings && Hashtbl.mem t.working tid then (
+    Hashtbl.remove t.working tid;
+    FW.duration_end ?args t.fxt ~name ~thread:FW.{ pid; tid } ~category ~ts)
+
+(* Scheduler states go on a track of their own next to the thread's,
+   their slices overlap the syscall slices instead of nesting in them *)
+let sched_track t ~pid ~tid =
+  let thread = FW.{ pid; tid = Int64.logor tid 0x1_0000_0000L } in
+  if not (Hashtbl.mem t.sched tid) then
+    FW.kernel_object t.fxt
+      ~args:[ ("process", `Koid pid) ]
+      ~name:(Printf.sprintf "%Ld:sched" tid)
+      `Thread thread.tid;
+  thread
+
+(* Ends the current state slice of [tid] and starts [state] *)
+let sched_state t ~pid ~tid ~ts state =
+  let thread = sched_track t ~pid ~tid in
+  (match Hashtbl.find_opt t.sched tid with
+  | Some prev when prev = state -> ()
+  | Some prev ->
+      FW.duration_end t.fxt ~name:prev ~thread ~category:"sched" ~ts;
+      FW.duration_begin t.fxt ~name:state ~thread ~category:"sched" ~ts
+  | None -> FW.duration_begin t.fxt ~name:state ~thread ~category:"sched" ~ts);
+  Hashtbl.replace t.sched tid state
+
+let sched_wakeup t ~pid ~tid ~cpu ~ts =
+  FW.thread_wakeup t.fxt ~cpu ~ts tid;
+  sched_state t ~pid ~tid ~ts "runnable"
+
+(* Block requests are async spans under the process that issued them,
+   block_queue from insertion to issue then block_device until
+   completion. Completions mostly run in interrupt context, so the
+   thread of the record itself is meaningless. The issue can be lost or
+   from before the block category was on, spans are only ended once
+   begun *)
+let block_ev ?args t ~ring_ctx ~pid ~ts ~rq phase =
+  if RingCtxSet.mem ring_ctx t.rings then
+    let thread = FW.{ pid; tid = pid } in
+    let correlation_id = rq in
+    match phase with
+    | `Insert ->
+        Hashtbl.replace t.block_queued rq ();
+        FW.async_begin ?args t.fxt ~name:"block_queue" ~thread ~category ~ts
+          ~correlation_id
+    | `Issue ->
+        if Hashtbl.mem t.block_queued rq then (
+          Hashtbl.remove t.block_queued rq;
+          FW.async_end t.fxt ~name:"block_queue" ~thread ~category ~ts
+            ~correlation_id);
+        Hashtbl.replace t.block_issued rq ();
+        FW.async_begin ?args t.fxt ~name:"block_device" ~thread ~category ~ts
+          ~correlation_id
+    | `Complete ->
+        if Hashtbl.mem t.block_issued rq then (
+          Hashtbl.remove t.block_issued rq;
+          FW.async_end ?args t.fxt ~name:"block_device" ~thread ~category ~ts
+            ~correlation_id)
+
+(* Counter ids of a ring's tracks, the low bits of its address are
+   always clear *)
+let counter_id ring_ctx track =
+  let base = ring_ctx |> Ctypes.raw_address_of_ptr |> Int64.of_nativeint in
+  match track with `Occupancy -> base | `Page_cache -> Int64.logor base 1L
+
+(* SQ and CQ depth as counter tracks of the ring's process, one per
+   ring *)
+let occupancy t ~ring_ctx ~pid ~ts ~sq ~cq =
+  if RingCtxSet.mem ring_ctx t.rings then
+    let name = Printf.sprintf "ring %s" (RingCtxPtr.show ring_ctx) in
+    let id = counter_id ring_ctx `Occupancy in
+    FW.counter t.fxt ~name ~thread:FW.{ pid; tid = pid } ~category ~ts ~id
+      ~args:
+        [
+          ("sq_depth", `Int64 (Int64.of_int sq));
+          ("cq_depth", `Int64 (Int64.of_int cq));
+        ]
+
+(* Share of the ring's requests that found all their pages cached, as
+   a counter track in percent *)
+let page_cache_ev t ~ring_ctx ~pid ~ts ~hit =
+  if RingCtxSet.mem ring_ctx t.rings then (
+    let id = counter_id ring_ctx `Page_cache in
+    let hits, total =
+      Option.value ~default:(0, 0) (Hashtbl.find_opt t.page_cache id)
+    in
+    let hits = if hit then hits + 1 else hits and total = total + 1 in
+    Hashtbl.replace t.page_cache id (hits, total);
+    let name = Printf.sprintf "ring %s page cache" (RingCtxPtr.show ring_ctx) in
+    FW.counter t.fxt ~name ~thread:FW.{ pid; tid = pid } ~category ~ts ~id
+      ~args:[ ("hit_ratio", `Int64 (Int64.of_int (hits * 100 / total))) ])
+
 let instant_event ?args t ~pid ~tid =
   let thread = FW.{ pid; tid } in
   FW.instant_event ?args t.fxt ~category ~thread
 
-let syscall_begin ?args t ~pid ~tid =
-  FW.duration_begin ?args t.fxt ~thread:FW.{ pid; tid } ~category:"syscalls"
+let syscall_begin ?args t ~pid ~tid ~name ~ts =
+  Hashtbl.replace t.syscalls tid ();
+  FW.duration_begin ?args t.fxt ~name ~thread:FW.{ pid; tid }
+    ~category:"syscalls" ~ts
 
-let syscall_end ?args t ~pid ~tid =
-  FW.duration_end ?args t.fxt ~thread:FW.{ pid; tid } ~category:"syscalls"
+(* Syscalls that were entered before tracing or their category was
+   switched on have no slice to end *)
+let syscall_end ?args t ~pid ~tid ~name ~ts =
+  if Hashtbl.mem t.syscalls tid then (
+    Hashtbl.remove t.syscalls tid;
+    FW.duration_end ?args t.fxt ~name ~thread:FW.{ pid; tid }
+      ~category:"syscalls" ~ts)
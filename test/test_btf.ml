@@ -0,0 +1,28 @@
+(* A BTF blob with no types and the given names in its string
+   section *)
+let btf names =
+  let strings = String.concat "\x00" ("" :: names) ^ "\x00" in
+  let header = Bytes.create 24 in
+  Bytes.set_uint16_le header 0 Btf.magic;
+  Bytes.set_uint8 header 2 1;
+  Bytes.set_uint8 header 3 0;
+  List.iteri
+    (fun i v -> Bytes.set_int32_le header (4 + (4 * i)) (Int32.of_int v))
+    [ 24; 0; 0; 0; String.length strings ];
+  Bytes.to_string header ^ strings
+
+let () =
+  let strings =
+    Btf.string_section (btf [ "io_kiocb"; "io_uring_submit_req" ])
+  in
+  assert (Btf.has_name strings "io_kiocb");
+  assert (Btf.has_name strings "io_uring_submit_req");
+  (* Only whole names match *)
+  assert (not (Btf.has_name strings "io_kioc"));
+  assert (not (Btf.has_name strings "kiocb"));
+  assert (not (Btf.has_name strings "io_uring_submit_sqe"));
+  (* Big-endian BTF isn't supported *)
+  (match Btf.string_section ("\xeb\x9f" ^ String.make 22 '\x00') with
+  | _ -> assert false
+  | exception Failure _ -> ());
+  print_endline "BTF names found"
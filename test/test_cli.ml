@@ -0,0 +1,23 @@
+let parse conv s = Cmdliner.Arg.conv_parser conv s
+
+let () =
+  assert (parse Cli.duration "500ns" = Ok 500);
+  assert (parse Cli.duration "500us" = Ok 500_000);
+  assert (parse Cli.duration "5ms" = Ok 5_000_000);
+  assert (parse Cli.duration "2s" = Ok 2_000_000_000);
+  List.iter
+    (fun s -> assert (Result.is_error (parse Cli.duration s)))
+    [ ""; "5"; "ms"; "0ms"; "-5ms"; "5m"; "1.5ms" ];
+  assert (parse Cli.positive "100" = Ok 100);
+  List.iter
+    (fun s -> assert (Result.is_error (parse Cli.positive s)))
+    [ "0"; "-1"; "1ms" ];
+  assert (parse (Cli.bounded ~min:1 ~max:8) "8" = Ok 8);
+  List.iter
+    (fun s -> assert (Result.is_error (parse (Cli.bounded ~min:1 ~max:8) s)))
+    [ "0"; "9"; "x" ];
+  assert (parse Cli.ratio "1/1000" = Ok (1, 1000));
+  List.iter
+    (fun s -> assert (Result.is_error (parse Cli.ratio s)))
+    [ "0/10"; "2/1"; "1"; "a/b" ];
+  print_endline "Arguments parsed"
@@ -0,0 +1,34 @@
+module FW = Fxt.Write
+module FR = Fxt.Read
+
+let thread = FW.{ pid = 1L; tid = 2L }
+
+let () =
+  let w = Eio.Buf_write.create 4096 in
+  let t = FW.of_writer w in
+  let category = "uring" in
+  FW.instant_event t ~name:"create" ~thread ~category ~ts:1L;
+  FW.flow_begin t ~name:"submit" ~thread ~category ~ts:2L ~correlation_id:42L
+    ~args:[ ("user_data", `Pointer 7L); ("opcode", `String "READ") ];
+  FW.kernel_object t ~name:"worker" `Thread 3L;
+  FW.flow_end t ~name:"complete" ~thread ~category ~ts:3L ~correlation_id:42L
+    ~args:[ ("res", `Int64 (-11L)) ];
+  let path = Filename.temp_file "test_fxt" ".fxt" in
+  Out_channel.with_open_bin path (fun oc ->
+      output_string oc (Eio.Buf_write.serialize_to_string w));
+  let events = ref [] in
+  In_channel.with_open_bin path
+    (FR.iter (fun e -> events := (e.FR.kind, e.name, e.ts, e.args) :: !events));
+  Sys.remove path;
+  (* Strings and threads are resolved, other records skipped *)
+  assert (
+    List.rev !events
+    = [
+        (`Instant, "create", 1L, []);
+        ( `Flow_begin,
+          "submit",
+          2L,
+          [ ("user_data", `Pointer 7L); ("opcode", `String "READ") ] );
+        (`Flow_end, "complete", 3L, [ ("res", `Int64 (-11L)) ]);
+      ]);
+  print_endline "Events read back"
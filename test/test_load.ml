@@ -1,7 +1,34 @@
 open Libbpf
 
+(* Loads every program the way uring-trace does: the variant this
+   kernel has, and only those whose attach point exists *)
 let () =
-  let obj_path = Site.bpf_object_path in
-  let program_names = Site.bpf_program_names in
-  with_bpf_object_open_load_link ~obj_path ~program_names (fun _ _ ->
+  let program_names =
+    Site.ring_program_names
+    @ Site.category_program_names (List.map fst Site.categories)
+    |> List.map Programs.variant
+  in
+  let obj = bpf_object_open Site.bpf_object_path in
+  Fun.protect
+    ~finally:(fun () -> bpf_object_close obj)
+    (fun () ->
+      Programs.select obj
+        (Site.snapshot_program_name :: Site.occupancy_program_name
+       :: program_names);
+      bpf_object_load obj;
+      let links =
+        List.sort_uniq compare program_names
+        |> List.filter_map (fun name ->
+               let prog = bpf_object_find_program_by_name obj name in
+               if not (Programs.loaded prog) then (
+                 Printf.printf "Skipped %s\n%!" name;
+                 None)
+               else
+                 match bpf_program_attach prog with
+                 | link -> Some link
+                 | exception Failure msg ->
+                     Printf.printf "Couldn't attach %s: %s\n%!" name msg;
+                     None)
+      in
+      List.iter bpf_link_destroy links;
       Printf.printf "Load success\n%!")
@@ -0,0 +1,38 @@
+open Shards
+
+let record ts = { ts; data = Int64.to_string ts }
+
+let push shard ts =
+  Mutex.protect shard.mutex (fun () -> Queue.push (record ts) shard.incoming)
+
+(* One round of the merge loop in [Shards.consume] *)
+let round shards out =
+  let upto = watermark shards in
+  Array.iter collect shards;
+  release shards ~upto (fun r -> out := r.ts :: !out)
+
+let () =
+  let busy = make_shard () and idle = make_shard () in
+  let shards = [| busy; idle |] in
+  let out = ref [] in
+  (* The idle shard has nothing but only polled up to 20 *)
+  List.iter (push busy) [ 10L; 30L ];
+  Atomic.set busy.polled 40L;
+  Atomic.set idle.polled 20L;
+  round shards out;
+  assert (!out = [ 10L ]);
+  (* It then delivers a record older than the busy shard's pending one *)
+  push idle 25L;
+  Atomic.set idle.polled 50L;
+  push busy 45L;
+  Atomic.set busy.polled 60L;
+  round shards out;
+  assert (List.rev !out = [ 10L; 25L; 30L; 45L ]);
+  (* Nothing is held back once everything is drained *)
+  push idle 55L;
+  release shards ~upto:Int64.max_int (fun r -> out := r.ts :: !out);
+  assert (List.rev !out = [ 10L; 25L; 30L; 45L ]);
+  Array.iter collect shards;
+  release shards ~upto:Int64.max_int (fun r -> out := r.ts :: !out);
+  assert (List.rev !out = [ 10L; 25L; 30L; 45L; 55L ]);
+  print_endline "Shards merge in order"
@@ -0,0 +1,33 @@
+open Symbolize
+
+let of_string s off len = String.sub s off len
+
+let () =
+  let funcs = [| (0x1000L, 0x10L, "a"); (0x2000L, 0L, "b") |] in
+  assert (lookup funcs 0x1000L = Some ("a", 0L));
+  assert (lookup funcs 0x1005L = Some ("a", 5L));
+  (* Past the end of a sized symbol *)
+  assert (lookup funcs 0x1010L = None);
+  assert (lookup funcs 0xfffL = None);
+  (* Unknown size, anything after it belongs to it *)
+  assert (lookup funcs 0x3000L = Some ("b", 0x1000L));
+  assert (lookup [||] 0x1000L = None);
+  (* Parse this very executable *)
+  let exe = In_channel.with_open_bin "/proc/self/exe" In_channel.input_all in
+  let elf =
+    In_channel.with_open_bin "/proc/self/exe" (fun ic ->
+        parse_elf (read_range ic))
+  in
+  let elf = Option.get elf in
+  assert (elf.loads <> []);
+  let value, size, _ =
+    Array.to_list elf.funcs |> List.find (fun (_, _, name) -> name = "main")
+  in
+  assert (size > 1L);
+  assert (lookup elf.funcs (Int64.succ value) = Some ("main", 1L));
+  assert (parse_elf (of_string exe) = Some elf);
+  (* Truncated and foreign files *)
+  assert (parse_elf (of_string (String.sub exe 0 200)) = None);
+  assert (parse_elf (of_string (String.sub exe 0 10)) = None);
+  assert (parse_elf (of_string (String.make 4096 'x')) = None);
+  print_endline "Symbols resolved"
@@ -0,0 +1,52 @@
+let ring_ctx = Ctypes.ptr_of_raw_address 0x1000n
+let pid = 1L
+let tid = 1L
+
+let () =
+  let t = Writer.make (Writer.of_writer (Eio.Buf_write.create 4096)) in
+  Writer.create_ring_ev t ~ring_ctx ~pid ~tid ~name:"create" ~comm:"test"
+    ~ts:0L;
+  let cqe ~ts ~more =
+    Writer.cqe_ev t ~ring_ctx ~name:"complete" ~pid ~tid ~ts
+      ~correlation_id:42L ~more
+  in
+  let cqes () =
+    Option.map
+      (fun s -> (s.Writer.cqes, s.max_gap))
+      (Hashtbl.find_opt t.Writer.multishot 42L)
+  in
+  (* A single shot request never gets multishot state *)
+  cqe ~ts:10L ~more:false;
+  assert (cqes () = None);
+  (* A multishot request is tracked until its CQE without MORE *)
+  cqe ~ts:20L ~more:true;
+  assert (cqes () = Some (1, 0L));
+  cqe ~ts:25L ~more:true;
+  cqe ~ts:40L ~more:true;
+  assert (cqes () = Some (3, 15L));
+  cqe ~ts:45L ~more:false;
+  assert (cqes () = None);
+  (* A new request at the same address resets a multishot request whose
+     last CQE was lost *)
+  cqe ~ts:50L ~more:true;
+  Writer.submit_ev t ~ring_ctx ~name:"submit" ~pid ~tid ~ts:60L
+    ~correlation_id:42L;
+  assert (cqes () = None);
+  (* Rings that aren't traced are ignored *)
+  let ring_ctx = Ctypes.ptr_of_raw_address 0x2000n in
+  Writer.cqe_ev t ~ring_ctx ~name:"complete" ~pid ~tid ~ts:70L
+    ~correlation_id:43L ~more:true;
+  assert (Hashtbl.find_opt t.Writer.multishot 43L = None);
+  print_endline "Multishot requests tracked";
+  (* Only block requests seen being issued get their span ended *)
+  let ring_ctx = Ctypes.ptr_of_raw_address 0x1000n in
+  let block ~ts phase = Writer.block_ev t ~ring_ctx ~pid ~ts ~rq:7L phase in
+  block ~ts:80L `Complete;
+  assert (not (Hashtbl.mem t.Writer.block_issued 7L));
+  block ~ts:90L `Insert;
+  block ~ts:100L `Issue;
+  assert (Hashtbl.mem t.Writer.block_issued 7L);
+  assert (not (Hashtbl.mem t.Writer.block_queued 7L));
+  block ~ts:110L `Complete;
+  assert (not (Hashtbl.mem t.Writer.block_issued 7L));
+  print_endline "Block spans tracked"